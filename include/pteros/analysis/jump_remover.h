@@ -48,6 +48,9 @@ public:
     // Remove jumps
     void remove_jumps(System& system);
 
+    /// True if there are atoms, which jumps are removed
+    bool is_active() const { return !no_jump_ind.empty() && dims.sum()>0; }
+
 private:    
     // Indexes for removing jumps
     std::vector<int> no_jump_ind;
@@ -0,0 +1,97 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+
+namespace pteros {
+
+/// Statistics of durations of repeated operation with logarithmic histogram.
+/// Could be updated and read by several threads concurrently.
+class Time_stats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Time_stats();
+
+    void add(Clock::duration d);
+
+    /// Adds the time passed since t0
+    void add_since(Clock::time_point t0){ add(Clock::now()-t0); }
+
+    /// Number of measurements
+    int64_t count() const { return n.load(std::memory_order_relaxed); }
+    /// All times are in seconds
+    double total() const;
+    double mean() const;
+    double max() const;
+    /// Estimate of given percentile (0-100) from histogram
+    double percentile(double p) const;
+
+    /// JSON object with count, total, mean, p50, p99 and max
+    std::string to_json() const;
+    /// Human readable summary
+    std::string summary() const;
+
+private:
+    // Bin i contains times from 2^(i-1) to 2^i microseconds
+    static constexpr int num_bins = 32;
+    std::atomic<int64_t> n;
+    std::atomic<int64_t> total_ns;
+    std::atomic<int64_t> max_ns;
+    std::array<std::atomic<int64_t>,num_bins> hist;
+};
+
+
+/// Timings of trajectory processing stages for one task
+struct Task_stats {
+    /// Waiting for new frames
+    Time_stats wait;
+    /// Decoding of deferred frames
+    Time_stats decode;
+    /// Taking the frame into the system, including waiting for shared frame
+    Time_stats copy;
+    /// Removing jumps over periodic boundaries
+    Time_stats jumps;
+    /// Processing frames including removal of jumps (map stage of ordered tasks)
+    Time_stats process;
+    /// Reduce stage of ordered tasks
+    Time_stats reduce;
+
+    std::string to_json() const;
+};
+
+}
+
+#endif // PIPELINE_STATS_H
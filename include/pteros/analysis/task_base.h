@@ -3,7 +3,10 @@
 
 #include "pteros/core/system.h"
 #include "pteros/analysis/frame_info.h"
+#include "pteros/analysis/pipeline_stats.h"
 #include <spdlog/spdlog.h>
+#include <iostream>
+#include <cstdint>
 
 // Forward declaration of the message channel
 template<class T>
@@ -43,11 +46,53 @@ public:
     // Default implementation of global preprocess for parallel tasks
     virtual void before_spawn(){}
 
+    /// Writes partial results of the task, which processed one shard of trajectory.
+    /// Called instead of post_process() in sharded mode.
+    virtual void save_state(std::ostream& out){}
+
+    /// Adds partial results of one shard written by save_state().
+    /// When shards are merged it is called for each non-empty shard in their order
+    /// after pre_process() (before_spawn() for ordered tasks) and is followed by post_process().
+    /// System contains the structure, not the trajectory frames, at this stage.
+    virtual void merge_state(std::istream& in){}
+
+    /// Declares atoms used by this task by selection text.
+    /// Should be called before running the trajectory reader.
+    /// If all tasks declare their atoms only the union of them is read from
+    /// trajectory, while other atoms keep the coordinates from the structure file.
+    /// Coordinate-dependent selections are evaluated for the structure file.
+    void use_atoms(const std::string& sel_text);
+
+    /// Declares atoms used by this task by indexes
+    void use_atoms(const std::vector<int>& ind);
+
+    /// Declares that this task does not modify coordinates, velocities or forces of its system.
+    /// Serial tasks, which don't modify frames, use the frame shared with other tasks
+    /// without copying it. Coordinates should not be accessed by pointers kept between frames.
+    void set_read_only_frames(bool val){ read_only_frames = val; }
+
 protected:
     virtual void set_id(int _id){ task_id = _id; }
 
     virtual bool is_parallel() = 0;    
 
+    // Ordered tasks run map stage in clones and reduce stage in order of frames
+    virtual bool is_ordered(){ return false; }
+
+    // Tasks, which implement save_state() and merge_state(), could be sharded
+    virtual bool is_mergeable(){ return false; }
+
+    /// Writes the header of saved state: tag of up to 8 characters,
+    /// version of the format and the number of stored items
+    static void write_state_header(std::ostream& out, const char* tag, int32_t version, int64_t count);
+
+    /// Reads the header written by write_state_header() and returns the number of items.
+    /// Throws if the tag or version don't match or if the data are truncated.
+    static int64_t read_state_header(std::istream& in, const char* tag, int32_t version);
+
+    // Returns true if the task may modify coordinates, so it needs its own copy of each frame
+    virtual bool modifies_frames(){ return !read_only_frames; }
+
     // Handlers, which call actual functions
     // Could be overriden in subclasses
     virtual void before_spawn_handler(){
@@ -66,14 +111,32 @@ protected:
         post_process(info);
     }
 
+    // Map stage of ordered tasks, returns the result for current frame
+    virtual std::shared_ptr<void> map_frame_handler(const Frame_info& info){
+        return nullptr;
+    }
+
+    // Reduce stage of ordered tasks, gets results of map stage in the order of frames
+    virtual void reduce_frame_handler(const std::shared_ptr<void>& result, const Frame_info& info){}
+
     int task_id;
     int n_consumed;
 
+    // Timings of processing stages, shared by all instances of parallel and ordered tasks
+    std::shared_ptr<Task_stats> pipeline_stats;
+
 private:        
 
     void put_frame(const Frame& frame);
     void put_system(const System& sys);
 
+    // Atoms declared by use_atoms()
+    std::vector<std::string> used_sel_texts;
+    std::vector<int> used_ind;
+    // Atoms present in received frames or nullptr if frames are complete
+    std::shared_ptr<const std::vector<int>> frame_atoms;
+    bool read_only_frames;
+
     std::shared_ptr<Task_driver> driver;
 };
 
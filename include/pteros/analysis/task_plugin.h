@@ -33,6 +33,59 @@ protected:
     void pre_process_handler() override;
     void process_frame_handler(const Frame_info& info) override;
     virtual void post_process_handler(const Frame_info& info) override;
+
+    // Jump remover modifies coordinates
+    bool modifies_frames() override {
+        return Task_base::modifies_frames() || jump_remover.is_active();
+    }
+};
+
+
+/// Base class for ordered tasks.
+/// Clones of the task compute results for different frames concurrently in map_frame(),
+/// while reduce_frame() of the original instance gets these results in the order of frames.
+/// Any number of ordered tasks could run together with serial tasks.
+/// before_spawn() is called in original instance, pre_process() - in each clone
+/// before its first frame and post_process() - in original instance after the last frame.
+/// Original instance does not see the coordinates of frames.
+template<class Result>
+class Task_ordered: public Task_plugin {
+public:
+    using Task_plugin::Task_plugin;
+
+protected:
+    virtual void map_frame(const Frame_info& info, Result& result) = 0;
+    virtual void reduce_frame(Result& result, const Frame_info& info) = 0;
+
+    void process_frame(const Frame_info& info) final {}
+
+    bool is_ordered() final { return true; }
+
+    std::shared_ptr<void> map_frame_handler(const Frame_info& info) override {
+        auto result = std::make_shared<Result>();
+        try {
+            auto t0 = Time_stats::Clock::now();
+            jump_remover.remove_jumps(system);
+            pipeline_stats->jumps.add_since(t0);
+
+            map_frame(info,*result);
+
+        } catch (const std::exception& e) {
+            log->error("map_frame failed on frame {}: {} ", info.valid_frame, e.what());
+            std::terminate();
+        }
+        return result;
+    }
+
+    void reduce_frame_handler(const std::shared_ptr<void>& result, const Frame_info& info) override {
+        try {
+            reduce_frame(*std::static_pointer_cast<Result>(result),info);
+
+        } catch (const std::exception& e) {
+            log->error("reduce_frame failed on frame {}: {} ", info.valid_frame, e.what());
+            std::terminate();
+        }
+    }
 };
 
 }
@@ -61,5 +114,20 @@ protected:
         bool is_parallel() final { return false; }
 
 
+#define TASK_ORDERED(_name,_result) \
+    class _name: public Task_ordered<_result> { \
+    public: \
+        using Task_ordered<_result>::Task_ordered; \
+        void set_id(int _id) override {\
+            log = create_logger(fmt::format(#_name ".{}",_id)); \
+            task_id = _id; \
+        } \
+    _name* clone() const override { \
+        return new _name(*this); \
+    } \
+    protected: \
+        bool is_parallel() final { return false; }
+
+
 
 #endif // TASK_BASE_H
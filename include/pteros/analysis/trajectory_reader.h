@@ -87,6 +87,12 @@ private:
 
         //void reader_thread_body(const Data_channel_ptr &channel);
 
+        // Writes states of tasks after processing one shard
+        void save_shard_state(const std::string& fname);
+
+        // Merges states of tasks from all shards and calls post_process
+        void merge_shards(int num_shards, const std::string& prefix);
+
         std::vector<std::string> traj_files;        
 
         std::vector<Task_ptr> tasks;
@@ -53,17 +53,17 @@ public:
     inline int& resid(){ return atom_ptr->resid; }
     inline const int& resid() const { return atom_ptr->resid; }
 
-    inline std::string& name(){ return atom_ptr->name; }
-    inline const std::string& name() const { return atom_ptr->name; }
+    inline Interned_string& name(){ return atom_ptr->name; }
+    inline const Interned_string& name() const { return atom_ptr->name; }
 
     inline char& chain(){ return atom_ptr->chain; }
     inline const char& chain() const { return atom_ptr->chain; }
 
-    inline std::string& resname(){ return atom_ptr->resname; }
-    inline const std::string& resname() const { return atom_ptr->resname; }
+    inline Interned_string& resname(){ return atom_ptr->resname; }
+    inline const Interned_string& resname() const { return atom_ptr->resname; }
 
-    inline std::string& tag(){ return atom_ptr->tag; }
-    inline const std::string& tag() const { return atom_ptr->tag; }
+    inline Interned_string& tag(){ return atom_ptr->tag; }
+    inline const Interned_string& tag() const { return atom_ptr->tag; }
 
     inline float& occupancy(){ return atom_ptr->occupancy; }
     inline const float& occupancy() const { return atom_ptr->occupancy; }
@@ -83,8 +83,8 @@ public:
     inline int& type(){ return atom_ptr->type; }
     inline const int& type() const { return atom_ptr->type; }
 
-    inline std::string& type_name(){ return atom_ptr->type_name; }
-    inline const std::string& type_name() const { return atom_ptr->type_name; }
+    inline Interned_string& type_name(){ return atom_ptr->type_name; }
+    inline const Interned_string& type_name() const { return atom_ptr->type_name; }
 
     inline float& x(){ return (*coord_ptr)(0); }
     inline const float& x() const { return (*coord_ptr)(0); }
@@ -35,6 +35,8 @@
 
 #include "pteros/core/selection.h"
 #include "pteros/core/distance_search_within.h"
+#include "pteros/core/neighbor_list.h"
+#include "pteros/core/distance_search_batch.h"
 
 namespace pteros {       
 
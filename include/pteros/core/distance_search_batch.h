@@ -0,0 +1,96 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#ifndef DISTANCE_SEARCH_BATCH_INCLUDED
+#define DISTANCE_SEARCH_BATCH_INCLUDED
+
+#include "pteros/core/selection.h"
+
+namespace pteros {       
+
+/** @brief Batch of contact searches performed with a single grid.
+Several queries with different selections and cutoffs are registered once.
+On each call to search() all atoms of all queries are put to one grid
+with the largest cutoff and the found pairs are dispatched to the queries
+according to their cutoffs and selections. This is much faster than
+calling search_contacts() for each query when selections overlap.
+All selections should belong to the same system and point to the same frame.
+Selections are bound by reference and should outlive the batch.
+At most 64 queries could be registered.
+\code
+Distance_search_batch batch(true,true);
+int q1 = batch.add_query(0.3, lipids, water);
+int q2 = batch.add_query(0.5, lipids, ions);
+int q3 = batch.add_query(0.4, protein);
+for(int fr=0; fr<sys.num_frames(); ++fr){
+    ...set frame of all selections...
+    batch.search();
+    auto& pairs = batch.get_pairs(q1);
+    auto& dist = batch.get_distances(q1);
+}
+\endcode
+ */
+class Distance_search_batch {
+public:
+    Distance_search_batch(bool absolute_index = false, bool periodic = false);
+
+    virtual ~Distance_search_batch();
+
+    /// Register query for contacts within single selection.
+    /// Returns the query id.
+    int add_query(float d, const Selection& sel);
+
+    /// Register query for contacts between two selections.
+    /// Returns the query id.
+    int add_query(float d, const Selection& sel1, const Selection& sel2);
+
+    /// Remove all queries
+    void clear();
+
+    int num_queries() const;
+
+    /// Perform all queries for current coordinates of bound selections
+    void search();
+
+    /// Pairs found for given query by last search.
+    /// Pairs are oriented as (sel1,sel2) for two-selection queries.
+    const std::vector<Eigen::Vector2i>& get_pairs(int q) const;
+
+    /// Distances for the pairs of given query
+    const std::vector<float>& get_distances(int q) const;
+
+private:
+    class Distance_search_batch_impl;
+    std::unique_ptr<Distance_search_batch_impl> p;
+};
+
+}
+
+#endif
+
@@ -59,6 +59,22 @@ public:
                        std::vector<int> &res,
                        bool include_self=true);
 
+    /// Number of source atoms within given distance from each atom of target.
+    /// If include_self is false the atom itself is not counted.
+    void count_within(const Selection& target,
+                      std::vector<int>& counts,
+                      bool include_self=true);
+
+    /// Up to k nearest source atoms within given distance for each atom of target.
+    /// Results for target atom i are in res[i*k:(i+1)*k] in the order of
+    /// increasing distance. Missing neighbours are marked by -1.
+    /// Optionally returns distances in the same layout.
+    void search_knn(const Selection& target,
+                    int k,
+                    std::vector<int>& res,
+                    std::vector<float>* dist_vec = nullptr,
+                    bool include_self=true);
+
 private:
     class Distance_search_within_impl;
     std::unique_ptr<Distance_search_within_impl> p;
@@ -31,18 +31,23 @@
 
 #include <Eigen/Core>
 #include <vector>
-#include <deque>
 #include "pteros/core/selection.h"
 
-#define BOOST_DISABLE_ASSERTS
-#include "boost/multi_array.hpp"
-
 namespace pteros {    
 
-    struct Grid_element {
-        int index;
-        Eigen::Vector3f* coor_ptr;
-        Grid_element(int i, Eigen::Vector3f* ptr): index(i),coor_ptr(ptr) {}
+    /// Read-only view of the atoms in one grid cell.
+    /// Coordinates are stored as structure of arrays, which are contiguous
+    /// for all atoms of the cell.
+    struct Grid_cell {
+        const float* x;
+        const float* y;
+        const float* z;
+        const int* ind;
+        int n;
+
+        int size() const { return n; }
+        int index(int i) const { return ind[i]; }
+        Eigen::Vector3f xyz(int i) const { return Eigen::Vector3f(x[i],y[i],z[i]); }
     };
 
     /**
@@ -62,16 +67,35 @@ namespace pteros {
             for(int k=0;k< 100;++k)
                 cout << g.cell(i,j,k).size() << endl;
     \endcode
+
+    Internally the grid is stored in compressed rows: atoms are sorted by cells
+    with counting sort and the cell i occupies the range [offsets[i],offsets[i+1])
+    of contiguous x,y,z and index arrays. Coordinates are copied into the grid
+    (wrapped into the box in periodic case), so the grid is a snapshot of the
+    selection at the moment of populating. Repeated populating reuses
+    allocated memory.
      */
     class Grid {
     public:
-        Grid(){}
+        Grid(): NX(0), NY(0), NZ(0) {}
         Grid(int X, int Y, int Z){ resize(X,Y,Z); }
         virtual ~Grid(){}
 
         void clear();
         void resize(int X, int Y, int Z);
-        std::vector<Grid_element>& cell(int i, int j, int k){ return data[i][j][k]; }
+
+        Grid_cell cell(int i, int j, int k) const {
+            int c = (i*NY+j)*NZ+k;
+            int b = offsets[c];
+            return Grid_cell{x.data()+b, y.data()+b, z.data()+b, ind.data()+b, offsets[c+1]-b};
+        }
+
+        int get_nx() const { return NX; }
+        int get_ny() const { return NY; }
+        int get_nz() const { return NZ; }
+
+        /// Total number of atoms in the grid
+        int num_atoms() const { return ind.size(); }
 
         /// Non-periodic populate
         void populate(const Selection& sel,bool abs_index = false);
@@ -81,17 +105,28 @@ namespace pteros {
                       Vector3f_const_ref max,
                       bool abs_index);
 
-        /// Periodic populate
+        /// Periodic populate.
+        /// Cells are the slices of the box in fractional coordinates,
+        /// so they are parallelepipeds for triclinic boxes.
         void populate_periodic(const Selection& sel,bool abs_index = false);
 
         void populate_periodic(const Selection& sel,
                       const Periodic_box& box,
                       bool abs_index);
-    private:        
-        boost::multi_array<std::vector<Grid_element>,3> data;
-        // Array of atomic coordinates, which have to be wrapped if periodic.
-        // This is in order not to touch real coordinates of atoms and improve speed.
-        std::deque<Eigen::Vector3f> wrapped_atoms;        
+    private:
+        int NX,NY,NZ;
+        // Start of each cell in atom arrays. Size is NX*NY*NZ+1.
+        std::vector<int> offsets;
+        // Coordinates and indexes of atoms sorted by cells
+        std::vector<float> x,y,z;
+        std::vector<int> ind;
+        // Linear cell index of each atom of selection (-1 if outside)
+        std::vector<int> atom_cell;
+        // Scratch coordinates of atoms (wrapped if periodic)
+        std::vector<Eigen::Vector3f> atom_coor;
+
+        // Counting sort of atoms into cells using atom_cell and atom_coor
+        void fill_cells(const Selection& sel, bool abs_index);
     };
 
 }
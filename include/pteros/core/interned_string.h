@@ -0,0 +1,110 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+#include <ostream>
+#include "spdlog/fmt/fmt.h"
+
+namespace pteros {
+
+/**
+* Immutable string, which is stored once per process in the table of interned strings.
+* Object only holds a pointer to the stored string, so copying it is as cheap
+* as copying a pointer and equal strings always have equal pointers. It is used
+* for textual fields of atoms, which have few distinct values (names, residue names, etc.)
+* It is implicitly convertible from and to std::string.
+*/
+class Interned_string {
+public:
+    /// Empty string
+    Interned_string(): ptr(empty_ptr()) {}
+
+    Interned_string(const std::string& s): ptr(intern(s)) {}
+
+    Interned_string(const char* s): ptr(intern(s)) {}
+
+    operator const std::string&() const { return *ptr; }
+
+    const std::string& str() const { return *ptr; }
+
+    const char* c_str() const { return ptr->c_str(); }
+
+    size_t size() const { return ptr->size(); }
+
+    bool empty() const { return ptr->empty(); }
+
+    char operator[](size_t i) const { return (*ptr)[i]; }
+
+    /// Unique identifier of the string value. Equal strings have equal ids.
+    const std::string* id() const { return ptr; }
+
+    bool operator==(const Interned_string& other) const { return ptr==other.ptr; }
+    bool operator!=(const Interned_string& other) const { return ptr!=other.ptr; }
+
+    // Comparisons with plain strings need explicit overloads since
+    // comparison operators of std::string are templates
+    bool operator==(const std::string& s) const { return *ptr==s; }
+    bool operator!=(const std::string& s) const { return *ptr!=s; }
+    bool operator==(const char* s) const { return *ptr==s; }
+    bool operator!=(const char* s) const { return *ptr!=s; }
+
+    /// Lexicographical order
+    bool operator<(const Interned_string& other) const { return *ptr<*other.ptr; }
+
+private:
+    const std::string* ptr;
+
+    static const std::string* intern(const std::string& s);
+    static const std::string* empty_ptr();
+};
+
+inline bool operator==(const std::string& s, const Interned_string& is){ return is==s; }
+inline bool operator!=(const std::string& s, const Interned_string& is){ return is!=s; }
+inline bool operator==(const char* s, const Interned_string& is){ return is==s; }
+inline bool operator!=(const char* s, const Interned_string& is){ return is!=s; }
+
+inline std::string operator+(const Interned_string& a, const std::string& b){ return a.str()+b; }
+inline std::string operator+(const std::string& a, const Interned_string& b){ return a+b.str(); }
+inline std::string operator+(const Interned_string& a, const char* b){ return a.str()+b; }
+inline std::string operator+(const char* a, const Interned_string& b){ return a+b.str(); }
+
+inline std::ostream& operator<<(std::ostream& os, const Interned_string& s){ return os << s.str(); }
+
+}
+
+template<>
+struct fmt::formatter<pteros::Interned_string>: fmt::formatter<fmt::string_view> {
+    template<typename FormatContext>
+    auto format(const pteros::Interned_string& s, FormatContext& ctx) const -> decltype(ctx.out()) {
+        return fmt::formatter<fmt::string_view>::format(fmt::string_view(s.str()), ctx);
+    }
+};
+
@@ -32,6 +32,7 @@
 #include "pteros/core/system.h"
 #include "pteros/core/selection.h"
 #include <bitset>
+#include <functional>
 
 namespace pteros {
 
@@ -90,6 +91,22 @@ public:
     /// Returns true if read operation is succesfull and false if not.    
     bool read(System* sys, Frame* frame, const Mol_file_content& what);
 
+    /// Function, which finishes reading of the frame obtained by read_deferred()
+    using Frame_decoder = std::function<void(Frame&)>;
+
+    /// Reads next trajectory frame, but may postpone expensive decoding.
+    /// Only the time and the box are guaranteed to be set on return, while
+    /// coordinates are filled by calling decoder(frame) later, possibly in other thread.
+    /// If the format has no deferred decoding decoder is set to nullptr
+    /// and the frame is read completely.
+    /// Returns false if there are no more frames.
+    bool read_deferred(Frame* frame, Frame_decoder& decoder);
+
+    /// Restricts reading of trajectory frames to given atoms.
+    /// Indexes should be sorted and unique. Frames then contain only these atoms
+    /// in the same order. Empty vector means reading all atoms.
+    void set_atom_subset(const std::vector<int>& ind);
+
     /// Write data from selection specidied by what.
     void write(const Selection& sel, const Mol_file_content& what);
 
@@ -108,6 +125,9 @@ public:
     // Report last position in trajectory, only for random-access trajectories
     virtual void tell_last_frame_and_time(int& step, float& t);
 
+    // Report byte offset of the next frame in the file or -1 if unknown
+    virtual int64_t tell_current_offset();
+
 protected:    
     Mol_file(std::string& file_name);
 
@@ -123,6 +143,11 @@ protected:
     Atom& atom_in_system(System& sys, int i);
     void append_atom_in_system(System& sys, Atom& at);
 
+    // Number of leading atoms, which should be read from trajectory frame
+    // to cover the subset of atoms. Formats, which are able to read only
+    // the part of frame, use it. All other atoms are ignored anyway.
+    int num_atoms_to_read() const;
+
     // Method to sanity check parameters send to read and write
     void sanity_check_read(System* sys, Frame* frame, const Mol_file_content &what) const;
     void sanity_check_write(const Selection& sel, const Mol_file_content& what) const;
@@ -130,10 +155,18 @@ protected:
     /// User-overriden method for reading
     virtual bool do_read(System* sys, Frame* frame, const Mol_file_content& what) = 0;
 
+    /// User-overriden method for deferred reading of trajectory frame.
+    /// Default implementation reads the frame completely.
+    virtual bool do_read_deferred(Frame* frame, Frame_decoder& decoder);
+
     /// User-overriden method for writing
     virtual void do_write(const Selection& sel, const Mol_file_content& what) = 0;
+
+private:
+    // Subset of atoms to read from trajectory
+    std::shared_ptr<const std::vector<int>> atom_subset;
 };
 
-void get_element_from_atom_name(std::string& name, int& anum, float& mass);
+void get_element_from_atom_name(const std::string& name, int& anum, float& mass);
 
 }
@@ -0,0 +1,105 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+
+#ifndef NEIGHBOR_LIST_INCLUDED
+#define NEIGHBOR_LIST_INCLUDED
+
+#include "pteros/core/selection.h"
+
+namespace pteros {       
+
+/** @brief Persistent Verlet neighbour list.
+Keeps the list of candidate pairs within cutoff+skin and only re-filters it
+by actual distances on subsequent calls. The list is rebuilt when atoms moved
+too far since the last build (twice the maximal displacement plus the change
+of box vectors exceeds the skin) or when the selections changed.
+Selections are bound by reference and should outlive the neighbour list.
+\code
+Neighbor_list nlist(0.5, sel1, sel2, 0.1, true, true);
+for(int fr=0; fr<sys.num_frames(); ++fr){
+    sel1.set_frame(fr);
+    sel2.set_frame(fr);
+    nlist.search_contacts(pairs, &dist);
+}
+\endcode
+ */
+class Neighbor_list {
+public:
+    Neighbor_list();
+
+    /// Neighbour list within single selection
+    Neighbor_list(float d,
+                  const Selection& sel,
+                  float skin = 0.1,
+                  bool absolute_index = false,
+                  bool periodic = false);
+
+    /// Neighbour list between two selections
+    Neighbor_list(float d,
+                  const Selection& sel1,
+                  const Selection& sel2,
+                  float skin = 0.1,
+                  bool absolute_index = false,
+                  bool periodic = false);
+
+    virtual ~Neighbor_list();
+
+    void setup(float d,
+               const Selection& sel,
+               float skin = 0.1,
+               bool absolute_index = false,
+               bool periodic = false);
+
+    void setup(float d,
+               const Selection& sel1,
+               const Selection& sel2,
+               float skin = 0.1,
+               bool absolute_index = false,
+               bool periodic = false);
+
+    /// Get pairs within cutoff for current coordinates of bound selections.
+    /// Optionally returns distances for each pair.
+    void search_contacts(std::vector<Eigen::Vector2i>& pairs,
+                         std::vector<float>* dist_vec = nullptr);
+
+    /// Force rebuilding the list on next search
+    void invalidate();
+
+    /// Number of list rebuilds performed so far
+    int num_builds() const;
+
+private:
+    class Neighbor_list_impl;
+    std::unique_ptr<Neighbor_list_impl> p;
+};
+
+}
+
+#endif
@@ -424,6 +424,16 @@ class Selection {
     /// Set coordinates of this selection for current frame
     void set_xyz(MatrixXf_const_ref coord);
 
+    /// Get zero-copy 3xN view of coordinates for the current frame.
+    /// Only possible for contiguous selections, throws otherwise.
+    Eigen::Map<Eigen::Matrix3Xf> xyz_view();
+    Eigen::Map<const Eigen::Matrix3Xf> xyz_view() const;
+
+    /// Get zero-copy 3xN view of coordinates for given frame.
+    /// Only possible for contiguous selections, throws otherwise.
+    Eigen::Map<Eigen::Matrix3Xf> xyz_view(int fr);
+    Eigen::Map<const Eigen::Matrix3Xf> xyz_view(int fr) const;
+
 
     /// Get masses of all atoms in selection
     std::vector<float> get_mass() const;
@@ -725,6 +735,12 @@ class Selection {
     /// Get the size of selection
     int size() const {return _index.size();}
 
+    /// Returns true if selection is a dense range of indexes without gaps.
+    /// Coordinates of such selection could be accessed by xyz_view() without copying.
+    bool is_contiguous() const {
+        return !_index.empty() && _index.back()-_index.front()+1 == int(_index.size());
+    }
+
     /// Returns true if selection was created from text string and false if it was
     /// constructed 'by hand' by appending indexes or other selections
     bool text_based() const {
@@ -737,6 +753,11 @@ class Selection {
         return (bool)parser;
     }
 
+    /// Returns the report about evaluation time of coordinate-dependent parts
+    /// of selection text accumulated over all frames.
+    /// Empty string is returned for not coordinate-dependent selections.
+    std::string get_eval_timing() const;
+
     /// "Flattens" selection by removing coordinate dependence and making it not text-based.
     /// Resulting selection is equivalent to plain set of indexes "index i1 i2 i3..."
     /// Useful to avoid recomputing selection on frame change when tracking given set of atoms
@@ -912,13 +933,13 @@ class Selection {
     /// Extracts type
     DEFINE_ACCESSOR(int,type)
     /// Extracts typename
-    DEFINE_ACCESSOR(std::string,type_name)
+    DEFINE_ACCESSOR(Interned_string,type_name)
     /// Extracts residue name
-    DEFINE_ACCESSOR(std::string,resname)
+    DEFINE_ACCESSOR(Interned_string,resname)
     /// Extracts chain
     DEFINE_ACCESSOR(char,chain)
     /// Extracts atom name
-    DEFINE_ACCESSOR(std::string,name)
+    DEFINE_ACCESSOR(Interned_string,name)
     /// Extracts atom mass
     DEFINE_ACCESSOR(float,mass)
     /// Extracts atom charge
@@ -930,7 +951,7 @@ class Selection {
     /// Extracts residue number
     DEFINE_ACCESSOR(int,resid)
     /// Extracts tag
-    DEFINE_ACCESSOR(std::string,tag)
+    DEFINE_ACCESSOR(Interned_string,tag)
 
     /// Extracts atom index in the system, which is pointed by selection
     inline int index(int ind) const { return _index[ind]; }
@@ -0,0 +1,118 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
+
+namespace pteros {
+
+/** @brief Process-wide pool of worker threads.
+ Used for parallel loops inside the library (distance search, etc.) instead
+ of spawning new threads on each call. Work is distributed dynamically
+ in chunks: all participating threads grab next chunk from a shared counter
+ until the range is exhausted, so the load is balanced automatically.
+ The calling thread participates in the loop as well.
+
+ Nested parallel loops (called from inside the pool or from the threads,
+ which are marked as serial) are executed in the calling thread.
+ \code
+ auto& pool = Thread_pool::instance();
+ std::vector<float> partial(pool.get_num_threads(),0.0);
+ pool.parallel_for(N, 1000, [&](int b, int e, int th){
+     for(int i=b;i<e;++i) partial[th] += f(i);
+ });
+ \endcode
+ */
+class Thread_pool {
+public:
+    /// Loop body called for the range [b:e) by participating thread with number th.
+    /// th is in the range [0:get_num_threads())
+    using Body_t = std::function<void(int b, int e, int th)>;
+
+    /// Global pool instance
+    static Thread_pool& instance();
+
+    ~Thread_pool();
+
+    /// Set total number of threads including the calling thread.
+    /// If n<=0 the number of hardware threads is used.
+    /// Also sets the number of OpenMP threads if OpenMP is used.
+    /// Loops running in other threads are completed by old workers.
+    /// Loops could still get thread numbers up to the old number of threads,
+    /// so per-thread buffers should not be sized while the number is changed.
+    void set_num_threads(int n);
+
+    /// Total number of threads including the calling thread
+    int get_num_threads() const { return num_threads; }
+
+    /// Run body over [0:n) in dynamic chunks of given size.
+    /// Body is always called for whole chunks, even if executed serially,
+    /// so b/chunk could be used as the chunk number.
+    /// Exceptions thrown in the body are rethrown in the calling thread.
+    void parallel_for(int n, int chunk, const Body_t& body);
+
+    /// Mark calling thread as serial. All parallel loops started from this
+    /// thread are executed in it without using the pool.
+    /// Used for the threads, which already run in parallel (i.e. instances of parallel tasks)
+    /// to avoid oversubscription.
+    static void set_thread_serial(bool val);
+
+private:
+    Thread_pool();
+    Thread_pool(const Thread_pool&) = delete;
+    Thread_pool& operator=(const Thread_pool&) = delete;
+
+    struct Job;
+
+    void start_workers(int n);
+    void stop_workers();
+    void worker_body();
+
+    std::atomic<int> num_threads;
+    std::vector<std::thread> workers;
+    // Number of workers accepting jobs, guarded by jobs_mutex
+    int num_workers;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::mutex jobs_mutex;
+    // Serializes changes of the number of threads
+    std::mutex config_mutex;
+    std::condition_variable jobs_cond;
+    bool stop_requested;
+};
+
+}
+
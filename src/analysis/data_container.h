@@ -3,6 +3,13 @@
 
 #include "pteros/core/system.h"
 #include "pteros/analysis/frame_info.h"
+#include "pteros/core/mol_file.h"
+#include "pteros/core/pteros_error.h"
+#include "pteros/core/logging.h"
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace pteros {
 
@@ -12,6 +19,102 @@ struct Data_container {
     Frame frame;
     /// Frame information
     Frame_info frame_info;
+    /// Decoder of frame coordinates if reading was deferred
+    Mol_file::Frame_decoder decoder;
+
+    /// Finishes reading of the frame. Called by consumers of the frame,
+    /// the decoding is done only once even if frame is shared by many tasks.
+    /// Returns false if the frame is corrupted.
+    bool decode(){
+        if(!decoder) return true;
+        if(!decoded.load(std::memory_order_acquire)){
+            std::lock_guard<std::mutex> lock(decode_mutex);
+            if(!decoded.load(std::memory_order_relaxed)){
+                try {
+                    decoder(frame);
+                } catch(const Pteros_error& e) {
+                    LOG()->warn("Frame {} is corrupted: {}",frame_info.absolute_frame,e.what());
+                    corrupted = true;
+                }
+                decoded.store(true,std::memory_order_release);
+            }
+        }
+        return !corrupted;
+    }
+
+    /// Prepares the container for reading new frame.
+    /// Memory of the frame is kept. Velocities and forces are cleared
+    /// since not all formats set them.
+    void reset(){
+        frame.vel.clear();
+        frame.force.clear();
+        decoder = nullptr;
+        corrupted = false;
+        decoded.store(false,std::memory_order_relaxed);
+    }
+
+    /// Guards the frame, which is shared between serial tasks
+    std::mutex frame_mutex;
+
+private:
+    std::mutex decode_mutex;
+    std::atomic<bool> decoded{false};
+    bool corrupted = false;
+};
+
+
+/// Pool of data containers, which are reused for reading frames.
+/// Containers return to the pool when the last consumer releases them,
+/// so in steady state the frames are not allocated at all.
+/// The pool keeps at most max_free released containers, the others are deleted.
+class Data_container_pool: public std::enable_shared_from_this<Data_container_pool> {
+public:
+    static std::shared_ptr<Data_container_pool> create(int max_free){
+        return std::shared_ptr<Data_container_pool>(new Data_container_pool(max_free));
+    }
+
+    ~Data_container_pool(){
+        for(auto p: free_list) delete p;
+    }
+
+    /// Returns free container or a new one if there are no free containers
+    std::shared_ptr<Data_container> get(){
+        Data_container* p = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!free_list.empty()){
+                p = free_list.back();
+                free_list.pop_back();
+            }
+        }
+        if(!p) p = new Data_container;
+
+        // Container may outlive the pool, then it is just deleted
+        std::weak_ptr<Data_container_pool> pool = shared_from_this();
+        return std::shared_ptr<Data_container>(p,[pool](Data_container* p){
+            auto owner = pool.lock();
+            if(owner) owner->put(p); else delete p;
+        });
+    }
+
+private:
+    Data_container_pool(int max_free): max_free(max_free) {}
+
+    void put(Data_container* p){
+        p->reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(int(free_list.size())<max_free){
+                free_list.push_back(p);
+                return;
+            }
+        }
+        delete p;
+    }
+
+    int max_free;
+    std::vector<Data_container*> free_list;
+    std::mutex mutex;
 };
 
 }
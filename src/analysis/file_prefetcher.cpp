@@ -0,0 +1,160 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+
+#include "file_prefetcher.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+using namespace std;
+using namespace pteros;
+
+// Size of single read of background thread
+static const int64_t chunk_size = 1<<20;
+
+
+File_prefetcher::Open_file::Open_file(const string &fname)
+{
+    size = 0;
+    // Errors are ignored here, they are reported by the reader of the file
+    fd = ::open(fname.c_str(),O_RDONLY);
+    if(fd<0) return;
+    struct stat st;
+    if(fstat(fd,&st)==0) size = st.st_size;
+    posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+}
+
+File_prefetcher::Open_file::~Open_file()
+{
+    if(fd>=0) ::close(fd);
+}
+
+
+File_prefetcher::File_prefetcher(int64_t window_size):
+    window(window_size), pos(-1), stop_now(false)
+{
+    t = std::thread(&File_prefetcher::thread_body,this);
+}
+
+File_prefetcher::~File_prefetcher()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stop_now = true;
+    }
+    cond.notify_one();
+    t.join();
+}
+
+void File_prefetcher::set_file(const string &fname, const string &next_fname)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        // Beginning of the next file may be prefetched already
+        if(next.file && next.name==fname){
+            cur = next;
+        } else {
+            cur = Slot();
+            cur.name = fname;
+            cur.file = make_shared<Open_file>(fname);
+        }
+
+        next = Slot();
+        if(!next_fname.empty()){
+            next.name = next_fname;
+            next.file = make_shared<Open_file>(next_fname);
+        }
+        pos = -1;
+    }
+    cond.notify_one();
+}
+
+void File_prefetcher::set_position(int64_t p)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        pos = p;
+    }
+    cond.notify_one();
+}
+
+shared_ptr<File_prefetcher::Open_file> File_prefetcher::next_chunk(int64_t &offset, int64_t &len)
+{
+    if(!cur.file || cur.file->fd<0 || pos<0) return nullptr;
+
+    // After seeking outside of prefetched region start the new one
+    if(pos<cur.begin || pos>cur.end) cur.begin = cur.end = pos;
+
+    int64_t limit = std::min(cur.file->size, pos+window);
+    if(cur.end<limit){
+        offset = cur.end;
+        len = std::min(chunk_size,limit-offset);
+        cur.end += len;
+        return cur.file;
+    }
+
+    // Rest of the window goes to the next file
+    int64_t rest = window - (cur.file->size-pos);
+    if(rest>0 && next.file && next.file->fd>=0){
+        limit = std::min(next.file->size, rest);
+        if(next.end<limit){
+            offset = next.end;
+            len = std::min(chunk_size,limit-offset);
+            next.end += len;
+            return next.file;
+        }
+    }
+
+    return nullptr;
+}
+
+void File_prefetcher::thread_body()
+{
+    vector<char> buf(chunk_size);
+    while(true){
+        int64_t offset, len;
+        shared_ptr<Open_file> f;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock,[&]{ return stop_now || (f = next_chunk(offset,len)); });
+            if(stop_now) return;
+        }
+
+        // The data are only needed in the page cache, so they are thrown away
+        posix_fadvise(f->fd,offset,len,POSIX_FADV_WILLNEED);
+        while(len>0){
+            auto n = pread(f->fd,buf.data(),len,offset);
+            if(n<=0) break;
+            offset += n;
+            len -= n;
+        }
+    }
+}
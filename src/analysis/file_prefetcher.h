@@ -0,0 +1,94 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#ifndef FILE_PREFETCHER_H
+#define FILE_PREFETCHER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+
+namespace pteros {
+
+/// Keeps a window of upcoming bytes of trajectory files in the page cache.
+/// Reading ahead is done by background thread with posix_fadvise(WILLNEED)
+/// and explicit reads, since the hints are ignored by many networked filesystems.
+/// When the rest of the current file is shorter than the window the beginning
+/// of the next file is prefetched as well.
+class File_prefetcher {
+public:
+    /// Window size is in bytes
+    File_prefetcher(int64_t window);
+    ~File_prefetcher();
+
+    /// Sets the file, which is read now, and the file, which will be read next (could be empty)
+    void set_file(const std::string& fname, const std::string& next_fname);
+
+    /// Reports the current reading position in the current file.
+    /// Negative position means that it is unknown and nothing is read ahead.
+    void set_position(int64_t pos);
+
+private:
+    // File descriptor is closed when the last user releases it
+    struct Open_file {
+        Open_file(const std::string& fname);
+        ~Open_file();
+        int fd;
+        int64_t size;
+    };
+
+    struct Slot {
+        std::string name;
+        std::shared_ptr<Open_file> file;
+        // Prefetched region
+        int64_t begin = 0;
+        int64_t end = 0;
+    };
+
+    int64_t window;
+    Slot cur, next;
+    int64_t pos; // Reading position in current file
+
+    std::thread t;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stop_now;
+
+    void thread_body();
+    // Finds the next chunk to prefetch. Returns nullptr if there is nothing to do.
+    std::shared_ptr<Open_file> next_chunk(int64_t& offset, int64_t& len);
+};
+
+}
+
+#endif // FILE_PREFETCHER_H
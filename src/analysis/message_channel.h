@@ -20,75 +20,287 @@
  * GPL because it prevents the distribution of bugged derivatives.
  *
 */
-
 #ifndef MESSAGE_CHANNEL_H
 #define MESSAGE_CHANNEL_H
 
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
-#include <functional>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include "pteros/analysis/pipeline_stats.h"
 
+/*
+ * Bounded multi-producer/multi-consumer channel.
+ *
+ * Messages are kept in a ring buffer of fixed capacity. Each slot carries
+ * a sequence number, which tells whether the slot is ready for writing
+ * or reading at given position, so senders and receivers only contend
+ * on the atomic head and tail positions and never take a lock while
+ * the channel is neither full nor empty.
+ *
+ * Threads, which can't proceed, spin briefly and then sleep on a condition
+ * variable. Mutex is only touched by sleeping threads and by those who
+ * wake them up, which happens only if somebody actually sleeps.
+ *
+ * Stop closes the tail position, so every message, for which send()
+ * returned true, is delivered to some receiver.
+ */
 template<class T>
 class Message_channel {
 public:
-    Message_channel(): buffer_size(10), stop_requested(false) { }
+    Message_channel(): stop_requested(false) { allocate(10); }
 
-    Message_channel(int sz): buffer_size(sz), stop_requested(false) { }
+    Message_channel(int sz): stop_requested(false) { allocate(sz); }
 
-    void set_buffer_size(int sz){        
-        std::lock_guard<std::mutex> lock(mutex);
-        buffer_size = sz;
-        cond.notify_all();
+    // Should be called before channel is used
+    void set_buffer_size(int sz){
+        allocate(sz);
     }
 
     void send_stop(){
-        std::lock_guard<std::mutex> lock(mutex);
-        stop_requested = true;
-        cond.notify_all();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop_requested.store(true);
+            tail.fetch_or(closed_bit);
+        }
+        not_full.notify_all();
+        not_empty.notify_all();
     }
 
     bool empty(){
-        std::lock_guard<std::mutex> lock(mutex);
-        return queue.empty();
+        return !can_pop();
     }
 
     bool send(T const& data){
-        std::unique_lock<std::mutex> lock(mutex);
+        // Occupancy of the buffer seen by sender
+        num_sent.fetch_add(1,std::memory_order_relaxed);
+        occupancy_sum.fetch_add(size(),std::memory_order_relaxed);
 
-        // Wait until buffer will clear a bit or until stop is requested
-        cond.wait(lock, [this]{return (queue.size()<buffer_size || stop_requested);} );
+        bool waiting = false;
+        pteros::Time_stats::Clock::time_point t0;
+        for(int spin=0;;++spin){
+            if(stop_requested.load(std::memory_order_acquire)) return false;
 
-        // If stop requested just do nothing
-        if(stop_requested) return false;
+            if(try_push(data)){
+                wake(num_waiting_receivers,not_empty);
+                if(waiting) send_waits.add_since(t0);
+                return true;
+            }
 
-        queue.push(data);
-        cond.notify_one();
-        return true;
+            if(!waiting){
+                waiting = true;
+                t0 = pteros::Time_stats::Clock::now();
+            }
+
+            if(spin<spin_count){
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Wait until buffer will clear a bit or until stop is requested
+            std::unique_lock<std::mutex> lock(mutex);
+            num_waiting_senders.fetch_add(1);
+            not_full.wait(lock, [this]{ return can_push() || stop_requested.load(); });
+            num_waiting_senders.fetch_sub(1);
+            spin = 0;
+        }
     }
 
     bool recieve(T& popped_value){
-        std::unique_lock<std::mutex> lock(mutex);
+        bool waiting = false;
+        pteros::Time_stats::Clock::time_point t0;
+        for(int spin=0;;++spin){
+            if(try_pop(popped_value)){
+                wake(num_waiting_senders,not_full);
+                if(waiting) recieve_waits.add_since(t0);
+                return true;
+            }
+
+            if(!waiting){
+                waiting = true;
+                t0 = pteros::Time_stats::Clock::now();
+            }
+
+            // If stop requested see if there is something left, if not return false
+            if(stop_requested.load(std::memory_order_acquire)){
+                if(drain(popped_value)){
+                    wake(num_waiting_senders,not_full);
+                    return true;
+                }
+                return false;
+            }
 
-        // Wait until something appears in the queue or until stop requested
-        cond.wait(lock, [this]{return (!queue.empty() || stop_requested);} );
+            if(spin<spin_count){
+                std::this_thread::yield();
+                continue;
+            }
 
-        // If stop requested see if there is something in, if not return false
-        if(stop_requested && queue.empty()) return false;
+            // Wait until something appears in the queue or until stop requested
+            std::unique_lock<std::mutex> lock(mutex);
+            num_waiting_receivers.fetch_add(1);
+            not_empty.wait(lock, [this]{ return can_pop() || stop_requested.load(); });
+            num_waiting_receivers.fetch_sub(1);
+            spin = 0;
+        }
+    }
+
+    /// Capacity of the buffer
+    int get_buffer_size() const { return capacity; }
+
+    /// Number of calls to send()
+    int64_t get_num_sent() const { return num_sent.load(std::memory_order_relaxed); }
 
-        popped_value=queue.front();
-        queue.pop();
-        cond.notify_all();
-        return true;
+    /// Mean number of messages in the buffer seen by senders
+    double mean_occupancy() const {
+        int64_t n = num_sent.load(std::memory_order_relaxed);
+        return n ? double(occupancy_sum.load(std::memory_order_relaxed))/n : 0.0;
+    }
+
+    /// Waits of senders for free space and receivers for messages.
+    /// Only the calls, which could not complete immediately, are counted.
+    pteros::Time_stats send_waits;
+    pteros::Time_stats recieve_waits;
+
+    // Recieves up to max_num messages at once and appends them to out.
+    // Blocks like recieve() until at least one message is available.
+    // Returns the number of recieved messages, which is zero only
+    // if stop is requested and channel is empty.
+    int recieve(std::vector<T>& out, int max_num){
+        T val;
+        if(max_num<=0 || !recieve(val)) return 0;
+        out.push_back(std::move(val));
+        int n = 1;
+        while(n<max_num && try_pop(val)){
+            out.push_back(std::move(val));
+            ++n;
+        }
+        if(n>1) wake(num_waiting_senders,not_full,true);
+        return n;
     }
 
 private:
-    int buffer_size;
-    std::condition_variable cond;
+    struct Slot {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static constexpr int spin_count = 64;
+    static constexpr size_t cache_line = 64;
+    // Set in tail position when stop is requested
+    static constexpr size_t closed_bit = size_t(1)<<(8*sizeof(size_t)-1);
+
+    // Slot sequences of neighbouring laps are only distinct if there are at least two slots
+    void allocate(int sz){
+        capacity = sz>2 ? sz : 2;
+        buffer = std::vector<Slot>(capacity);
+        for(size_t i=0;i<capacity;++i) buffer[i].seq.store(i,std::memory_order_relaxed);
+        head.store(0);
+        tail.store(0);
+    }
+
+    // Slot at position pos is free for writing if its sequence is pos
+    // and is ready for reading if its sequence is pos+1
+    bool try_push(T const& data){
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for(;;){
+            if(pos & closed_bit) return false;
+            Slot& s = buffer[pos%capacity];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            if(seq==pos){
+                if(tail.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){
+                    s.data = data;
+                    s.seq.store(pos+1,std::memory_order_release);
+                    return true;
+                }
+            } else if(seq<pos){
+                return false; // Full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& popped_value){
+        size_t pos = head.load(std::memory_order_relaxed);
+        for(;;){
+            Slot& s = buffer[pos%capacity];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            if(seq==pos+1){
+                if(head.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){
+                    popped_value = std::move(s.data);
+                    s.data = T(); // Don't hold the message in the buffer
+                    s.seq.store(pos+capacity,std::memory_order_release);
+                    return true;
+                }
+            } else if(seq<pos+1){
+                return false; // Empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Pops remaining messages after stop. Messages could still be written
+    // to the slots reserved before the tail was closed, so wait for them.
+    bool drain(T& popped_value){
+        for(;;){
+            if(try_pop(popped_value)) return true;
+            size_t t = tail.load();
+            if((t & closed_bit) && head.load()>=(t & ~closed_bit)) return false;
+            std::this_thread::yield();
+        }
+    }
+
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_relaxed) & ~closed_bit;
+        size_t h = head.load(std::memory_order_relaxed);
+        return t>h ? t-h : 0;
+    }
+
+    bool can_push(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t pos = tail.load();
+        return !(pos & closed_bit) && buffer[pos%capacity].seq.load()==pos;
+    }
+
+    bool can_pop(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t pos = head.load();
+        return buffer[pos%capacity].seq.load()==pos+1;
+    }
+
+    // Waiters register themselves before checking the channel state and
+    // wakers check for waiters after changing it, so the fences guarantee
+    // that either the waiter sees the change or the waker sees the waiter.
+    void wake(std::atomic<int>& num_waiting, std::condition_variable& cond, bool all=false){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(num_waiting.load()>0){
+            { std::lock_guard<std::mutex> lock(mutex); }
+            if(all) cond.notify_all(); else cond.notify_one();
+        }
+    }
+
+    size_t capacity;
+    std::vector<Slot> buffer;
+
+    // Positions are kept on separate cache lines to avoid false sharing
+    // between senders and receivers
+    char pad0[cache_line];
+    std::atomic<size_t> tail;
+    char pad1[cache_line];
+    std::atomic<size_t> head;
+    char pad2[cache_line];
+
+    std::atomic<bool> stop_requested;
+    std::atomic<int> num_waiting_senders{0};
+    std::atomic<int> num_waiting_receivers{0};
+    std::atomic<int64_t> num_sent{0};
+    std::atomic<int64_t> occupancy_sum{0};
     std::mutex mutex;
-    std::queue<T> queue;
-    bool stop_requested;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
 };
 
 
@@ -0,0 +1,104 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "pteros/analysis/pipeline_stats.h"
+#include "spdlog/fmt/fmt.h"
+#include <cmath>
+
+using namespace std;
+using namespace pteros;
+
+Time_stats::Time_stats(): n(0), total_ns(0), max_ns(0)
+{
+    for(auto& h: hist) h.store(0);
+}
+
+void Time_stats::add(Clock::duration d)
+{
+    int64_t ns = chrono::duration_cast<chrono::nanoseconds>(d).count();
+    n.fetch_add(1,memory_order_relaxed);
+    total_ns.fetch_add(ns,memory_order_relaxed);
+
+    int64_t m = max_ns.load(memory_order_relaxed);
+    while(ns>m && !max_ns.compare_exchange_weak(m,ns,memory_order_relaxed)){}
+
+    int bin = 0;
+    for(int64_t us = ns/1000; us>0 && bin<num_bins-1; us >>= 1) ++bin;
+    hist[bin].fetch_add(1,memory_order_relaxed);
+}
+
+double Time_stats::total() const
+{
+    return total_ns.load(memory_order_relaxed)*1e-9;
+}
+
+double Time_stats::mean() const
+{
+    int64_t cnt = count();
+    return cnt ? total()/cnt : 0.0;
+}
+
+double Time_stats::max() const
+{
+    return max_ns.load(memory_order_relaxed)*1e-9;
+}
+
+double Time_stats::percentile(double p) const
+{
+    int64_t cnt = count();
+    if(cnt==0) return 0.0;
+
+    // Upper bound of the bin, which contains the percentile
+    int64_t target = std::ceil(cnt*p/100.0);
+    int64_t cum = 0;
+    for(int i=0; i<num_bins; ++i){
+        cum += hist[i].load(memory_order_relaxed);
+        if(cum>=target) return std::min(std::ldexp(1e-6,i),max());
+    }
+    return max();
+}
+
+string Time_stats::to_json() const
+{
+    return fmt::format(R"({{"n":{},"total":{:.6g},"mean":{:.6g},"p50":{:.6g},"p99":{:.6g},"max":{:.6g}}})",
+                       count(),total(),mean(),percentile(50),percentile(99),max());
+}
+
+string Time_stats::summary() const
+{
+    return fmt::format("{:.3f} s ({} x {:.3g} ms, p99 {:.3g} ms, max {:.3g} ms)",
+                       total(),count(),mean()*1e3,percentile(99)*1e3,max()*1e3);
+}
+
+string Task_stats::to_json() const
+{
+    return fmt::format(R"({{"wait":{},"decode":{},"copy":{},"jumps":{},"process":{},"reduce":{}}})",
+                       wait.to_json(),decode.to_json(),copy.to_json(),
+                       jumps.to_json(),process.to_json(),reduce.to_json());
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+namespace pteros {
+
+/// Restores the order of items, which are produced concurrently.
+/// Items are numbered consecutively starting from given number. Producers put them
+/// in any order and consumer gets them in the order of numbers.
+/// Producer, which is too far ahead of consumer, waits until its slot is free.
+template<class T>
+class Reorder_buffer {
+public:
+    Reorder_buffer(int sz, int producers, int first = 0):
+        items(sz), ready(sz,false), next(first), end(std::numeric_limits<int>::max()),
+        num_producers(producers), num_waiting(0) {}
+
+    void put(int n, T&& item){
+        std::unique_lock<std::mutex> lock(mutex);
+        ++num_waiting;
+        not_full.wait(lock, [&]{ return n < next+int(items.size()) || n>=end; });
+        --num_waiting;
+        if(n>=end) return; // Beyond the end, item is discarded
+
+        int i = n%items.size();
+        items[i] = std::move(item);
+        ready[i] = true;
+        if(n==next) not_empty.notify_one();
+    }
+
+    /// Should be called by each producer when it is finished
+    void producer_done(){
+        std::lock_guard<std::mutex> lock(mutex);
+        --num_producers;
+        not_empty.notify_one();
+    }
+
+    /// Ends the sequence before item n. Items with larger numbers are discarded.
+    void stop_at(int n){
+        std::lock_guard<std::mutex> lock(mutex);
+        end = std::min(end,n);
+        not_full.notify_all();
+        not_empty.notify_one();
+    }
+
+    /// Returns false if the end is reached or if all producers are finished
+    /// and next item is missing
+    bool get(T& item){
+        std::unique_lock<std::mutex> lock(mutex);
+        int i = next%items.size();
+        not_empty.wait(lock, [&]{ return ready[i] || num_producers==0 || next>=end; });
+        if(!ready[i] || next>=end) return false;
+
+        item = std::move(items[i]);
+        ready[i] = false;
+        ++next;
+        if(num_waiting) not_full.notify_all();
+        return true;
+    }
+
+private:
+    std::vector<T> items;
+    std::vector<bool> ready;
+    int next;
+    int end;
+    int num_producers;
+    int num_waiting;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+}
+
+#endif // REORDER_BUFFER_H
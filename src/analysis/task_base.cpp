@@ -1,10 +1,13 @@
 #include "pteros/analysis/task_base.h"
 #include "task_driver.h"
+#include "pteros/core/pteros_error.h"
+#include <cstring>
 
 using namespace std;
 using namespace pteros;
 
-Task_base::Task_base(): task_id(-1), n_consumed(0)
+Task_base::Task_base(): task_id(-1), n_consumed(0), pipeline_stats(new Task_stats),
+    read_only_frames(false)
 {
     //cout << "ctor: Task_base" << endl;
     driver.reset(new Task_driver(this));
@@ -18,12 +21,69 @@ Task_base::Task_base(const Task_base &other)
     system = other.system;
     task_id = -1;
     n_consumed = 0;
+    used_sel_texts = other.used_sel_texts;
+    used_ind = other.used_ind;
+    frame_atoms = other.frame_atoms;
+    read_only_frames = other.read_only_frames;
+    pipeline_stats = other.pipeline_stats;
+}
+
+void Task_base::use_atoms(const string &sel_text){
+    used_sel_texts.push_back(sel_text);
+}
+
+void Task_base::use_atoms(const std::vector<int> &ind){
+    used_ind.insert(used_ind.end(),ind.begin(),ind.end());
 }
 
 void pteros::Task_base::put_frame(const pteros::Frame &frame){
-    system.frame(0) = frame;
+    if(!frame_atoms){
+        system.frame(0) = frame;
+        return;
+    }
+
+    // Frame contains only the subset of atoms, other atoms are not updated
+    Frame& fr = system.frame(0);
+    const vector<int>& ind = *frame_atoms;
+    int n = ind.size();
+    for(int i=0;i<n;++i) fr.coord[ind[i]] = frame.coord[i];
+    if(frame.has_vel()){
+        fr.vel.resize(fr.coord.size());
+        for(int i=0;i<n;++i) fr.vel[ind[i]] = frame.vel[i];
+    }
+    if(frame.has_force()){
+        fr.force.resize(fr.coord.size());
+        for(int i=0;i<n;++i) fr.force[ind[i]] = frame.force[i];
+    }
+    fr.box = frame.box;
+    fr.time = frame.time;
 }
 
 void pteros::Task_base::put_system(const pteros::System &sys){
     if(!system.num_atoms()) system = sys;
 }
+
+void Task_base::write_state_header(ostream &out, const char *tag, int32_t version, int64_t count)
+{
+    char magic[8] = {0};
+    strncpy(magic,tag,8);
+    out.write(magic,8);
+    out.write((char*)&version,sizeof(version));
+    out.write((char*)&count,sizeof(count));
+}
+
+int64_t Task_base::read_state_header(istream &in, const char *tag, int32_t version)
+{
+    char magic[8], expected[8] = {0};
+    int32_t ver;
+    int64_t count;
+    strncpy(expected,tag,8);
+    in.read(magic,8);
+    in.read((char*)&ver,sizeof(ver));
+    in.read((char*)&count,sizeof(count));
+    if(!in) throw Pteros_error("State header '{}' is truncated!",tag);
+    if(memcmp(magic,expected,8)) throw Pteros_error("Data are not the state '{}'!",tag);
+    if(ver!=version) throw Pteros_error("State '{}' has version {}, but version {} is supported!",tag,ver,version);
+    if(count<0) throw Pteros_error("State '{}' has negative number of items!",tag);
+    return count;
+}
@@ -1,9 +1,12 @@
 #include "task_driver.h"
+#include "pteros/core/thread_pool.h"
+#include <sstream>
 
 using namespace std;
 using namespace pteros;
 
-Task_driver::Task_driver(Task_base *_task): task(_task), stop_now(false)
+Task_driver::Task_driver(Task_base *_task): task(_task), stop_now(false), exclusive_frames(false),
+    num_mappers(1), first_valid_frame(0), batch_size(1), sharded(false), reorder(nullptr)
 {
     //cout << "ctor: Task_driver" << endl;
 }
@@ -24,25 +27,176 @@ void Task_driver::set_data_channel_and_system(const Data_channel_ptr &ch, const
 }
 
 void Task_driver::process_until_end() {
+    // Original instance of ordered task only runs reduce stage
+    if(task->is_ordered() && !reorder){
+        process_ordered_until_end();
+        return;
+    }
+
     pre_process_done = false;
-    while(channel->recieve(data)){
-        if(stop_now) return; // Emergency stop point
+    // Instances of parallel and ordered tasks already run concurrently,
+    // so they should not use the thread pool themselves
+    bool concurrent = task->is_parallel() || reorder;
+    if(concurrent) Thread_pool::set_thread_serial(true);
+
+    // Complete frames are swapped into the system instead of copying if possible.
+    // Exclusive frames are just taken from container. Shared frames are taken
+    // for the time of processing by tasks, which don't modify them,
+    // while other tasks have to wait. Tasks usually process different frames
+    // at the same time, so they rarely wait for each other.
+    bool bind = !task->frame_atoms && (exclusive_frames || !task->modifies_frames());
+    bool shared_bind = bind && !exclusive_frames;
+
+    Task_stats& stats = *task->pipeline_stats;
+    auto t0 = Time_stats::Clock::now();
+
+    // Frames are taken from the channel in batches to reduce contention
+    // between instances of parallel task. Frames remaining in the batch
+    // after the corrupted one are dropped like those left in the channel.
+    vector<shared_ptr<Data_container>> batch;
+    size_t batch_pos = 0;
+    auto recieve_next = [&](shared_ptr<Data_container>& next){
+        if(batch_pos==batch.size()){
+            batch.clear();
+            batch_pos = 0;
+            if(!channel->recieve(batch,batch_size)) return false;
+        }
+        next = std::move(batch[batch_pos++]);
+        return true;
+    };
+
+    // Last processed frame stays in data if the next one is corrupted
+    shared_ptr<Data_container> next;
+    while(recieve_next(next)){
+        stats.wait.add_since(t0);
+
+        if(stop_now){ // Emergency stop point
+            if(reorder) reorder->producer_done();
+            return;
+        }
+
+        t0 = Time_stats::Clock::now();
+        bool good = next->decode();
+        stats.decode.add_since(t0);
+
+        // Corrupted frame ends the trajectory as in sequential reading.
+        // Instances of parallel task, which take frames concurrently, may still
+        // process few following frames already taken from the channel.
+        if(!good){
+            channel->send_stop();
+            if(reorder) reorder->stop_at(next->frame_info.valid_frame);
+            break;
+        }
+        data = std::move(next);
+
+        t0 = Time_stats::Clock::now();
+        unique_lock<mutex> lock(data->frame_mutex, defer_lock);
+        if(!exclusive_frames) lock.lock();
+
+        if(bind){
+            swap(task->system.frame(0), data->frame);
+        } else {
+            task->put_frame(data->frame);
+            if(lock) lock.unlock();
+        }
+        stats.copy.add_since(t0);
 
-        task->put_frame(data->frame);
         if(!pre_process_done){
             task->pre_process_handler();
             pre_process_done = true;
         }
-        task->process_frame_handler(data->frame_info);
+
+        t0 = Time_stats::Clock::now();
+        shared_ptr<void> result;
+        if(reorder){
+            result = task->map_frame_handler(data->frame_info);
+        } else {
+            task->process_frame_handler(data->frame_info);
+        }
+        stats.process.add_since(t0);
         ++task->n_consumed;
+
+        // Waiting for the reduce stage is also idle time
+        t0 = Time_stats::Clock::now();
+
+        // Return shared frame
+        if(shared_bind) swap(task->system.frame(0), data->frame);
+
+        // Result is passed to reduce stage after releasing the frame
+        // since waiting for preceding frames may take a while
+        if(reorder){
+            if(lock) lock.unlock();
+            reorder->put(data->frame_info.valid_frame, Mapped_frame{result,data->frame_info});
+        }
     }
-    if(task->n_consumed>0){        
-        task->post_process_handler(data->frame_info);        
+    if(reorder){
+        // Clones of ordered task are finalized by reduce stage
+        reorder->producer_done();
+    } else if(task->n_consumed>0){        
+        // Shared frames were returned, so put the last one to the system
+        if(shared_bind){
+            lock_guard<mutex> lock(data->frame_mutex);
+            task->put_frame(data->frame);
+        }
+        finish(data->frame_info);
+    } else {
+        task->log->warn("No frames consumed!");
+    }
+    if(concurrent) Thread_pool::set_thread_serial(false);
+}
+
+void Task_driver::process_ordered_until_end()
+{
+    // System is already set, so call user-defined init before cloning
+    task->before_spawn_handler();
+
+    // Mappers could run ahead of the reducer by few frames each
+    Reorder_buffer<Mapped_frame> buffer(4*num_mappers, num_mappers, first_valid_frame);
+
+    // Clones take frames from the same channel concurrently
+    vector<shared_ptr<Task_base>> mappers;
+    for(int i=0; i<num_mappers; ++i){
+        mappers.emplace_back(task->clone());
+        auto& m = mappers.back();
+        m->log = task->log;
+        m->task_id = task->task_id;
+        m->driver->channel = channel;
+        m->driver->exclusive_frames = exclusive_frames;
+        m->driver->reorder = &buffer;
+        m->driver->process_until_end_in_thread();
+    }
+
+    Mapped_frame mf;
+    while(buffer.get(mf)){
+        auto t0 = Time_stats::Clock::now();
+        task->reduce_frame_handler(mf.result,mf.info);
+        task->pipeline_stats->reduce.add_since(t0);
+        ++task->n_consumed;
+        last_info = mf.info;
+    }
+
+    for(auto& m: mappers) m->driver->join_thread();
+
+    if(task->n_consumed>0){
+        finish(last_info);
     } else {
         task->log->warn("No frames consumed!");
     }
 }
 
+void Task_driver::finish(const Frame_info &info)
+{
+    last_info = info;
+    if(sharded){
+        // Results of shards are merged later
+        ostringstream out;
+        task->save_state(out);
+        state = out.str();
+    } else {
+        task->post_process_handler(info);
+    }
+}
+
 void Task_driver::process_until_end_in_thread() {
     t = std::thread(&Task_driver::process_until_end, this);
 }
@@ -3,6 +3,7 @@
 #include "message_channel.h"
 #include "pteros/core/pteros_error.h"
 #include "data_container.h"
+#include "reorder_buffer.h"
 #include <iostream>
 
 namespace pteros {
@@ -10,21 +11,53 @@ namespace pteros {
 using Data_channel = Message_channel<std::shared_ptr<pteros::Data_container> > ;
 using Data_channel_ptr = std::shared_ptr<Data_channel> ;
 
+/// Result of map stage of ordered task
+struct Mapped_frame {
+    std::shared_ptr<void> result;
+    Frame_info info;
+};
+
 class Task_driver {
 public:
     Task_driver(Task_base* _task);
     virtual ~Task_driver();
     void set_data_channel_and_system(const Data_channel_ptr& ch, const System &sys);
+    /// Set to true if frames are not sent to any other task
+    void set_exclusive_frames(bool val){ exclusive_frames = val; }
+    /// Set the number of clones running map stage of ordered task
+    void set_num_mappers(int n){ num_mappers = n; }
+    /// Set the number of the first frame, which is processed
+    void set_first_valid_frame(int n){ first_valid_frame = n; }
+    /// Set the maximal number of frames taken from the channel at once
+    void set_batch_size(int n){ batch_size = n; }
+    /// In sharded mode task state is saved instead of post processing
+    void set_sharded(bool val){ sharded = val; }
+    /// Saved state of the task in sharded mode
+    const std::string& get_state() const { return state; }
+    /// Information about the last processed frame
+    const Frame_info& get_last_info() const { return last_info; }
     void process_until_end();
     void process_until_end_in_thread ();
     void join_thread();
 private:
+    void process_ordered_until_end();
+    void finish(const Frame_info& info);
+
     Data_channel_ptr channel;
     Task_base* task;
     std::shared_ptr<Data_container> data;
     std::thread t;    
     bool stop_now; // Emergency stop flag for thread
     bool pre_process_done;
+    bool exclusive_frames;
+    int num_mappers;
+    int first_valid_frame;
+    int batch_size;
+    bool sharded;
+    std::string state;
+    Frame_info last_info;
+    // Buffer for results of map stage if the task is a clone of ordered task
+    Reorder_buffer<Mapped_frame>* reorder;
 };
 
 
@@ -8,8 +8,8 @@ pteros::Task_plugin::Task_plugin(const pteros::Task_plugin &other): Task_base(ot
 
 void pteros::Task_plugin::before_spawn_handler() {
     before_spawn();
-    // For parallel tasks init jump remover here
-    if(is_parallel()) jump_remover.remove_jumps(system);
+    // For parallel and ordered tasks init jump remover here
+    if(is_parallel() || is_ordered()) jump_remover.remove_jumps(system);
 }
 
 void pteros::Task_plugin::pre_process_handler()
@@ -18,7 +18,7 @@ void pteros::Task_plugin::pre_process_handler()
         pre_process();
 
         // For serial tasks init jump remover here
-        if(!is_parallel()) jump_remover.remove_jumps(system);
+        if(!is_parallel() && !is_ordered()) jump_remover.remove_jumps(system);
 
     } catch (const std::exception& e) {
         log->error("pre_process failed: {}", e.what());
@@ -29,7 +29,10 @@ void pteros::Task_plugin::pre_process_handler()
 void pteros::Task_plugin::process_frame_handler(const pteros::Frame_info &info)
 {
     try {
+        auto t0 = Time_stats::Clock::now();
         jump_remover.remove_jumps(system);
+        pipeline_stats->jumps.add_since(t0);
+
         process_frame(info);
 
     } catch (const std::exception& e) {
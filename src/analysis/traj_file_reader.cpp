@@ -1,8 +1,10 @@
 #include "traj_file_reader.h"
+#include "file_prefetcher.h"
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/mol_file.h"
 #include <boost/algorithm/string.hpp> // For to_lower
 #include <boost/lexical_cast.hpp>
+#include <limits>
 
 using namespace std;
 using namespace pteros;
@@ -35,8 +37,9 @@ void process_suffix_value(const string& s, int* intval, float* floatval){
     }
 }
 
-Traj_file_reader::Traj_file_reader(Options &options, int natoms){
+Traj_file_reader::Traj_file_reader(Options &options, int natoms, const std::vector<int> &atom_subset){
     Natoms = natoms;
+    subset = atom_subset;
 
     // Separate reader logger (not registered since only used here)
     log = create_logger("traj_file");
@@ -64,6 +67,16 @@ Traj_file_reader::Traj_file_reader(Options &options, int natoms){
         throw Pteros_error("Last time {} is smaller that first time {}", last_time, first_time);
 
     log_interval = options("log","-1").as_int();
+
+    // Frames in flight are in the reader channel, the channels of serial tasks
+    // and in the consumer threads
+    pool_size = 2*options("buffer","10").as_int() + std::thread::hardware_concurrency();
+
+    prefetch_size = int64_t(options("prefetch","32").as_float()*(1<<20));
+    if(prefetch_size<0) throw Pteros_error("Prefetch size should not be negative!");
+
+    shard_file = -1;
+    progress_interval = -1;
 }
 
 bool Traj_file_reader::is_frame_valid(int fr, float t){
@@ -93,6 +106,75 @@ bool Traj_file_reader::is_end_of_interval(int fr, float t){
     }
 }
 
+int Traj_file_reader::set_shard(const vector<string> &traj_files, int num_shards, int shard_id){
+    if(first_time>=0 || last_time>=0)
+        throw Pteros_error("Range of frames should be given in frames for sharded processing!");
+
+    // Number of frames in each file, absolute number of the first frame
+    // and its position in reading order
+    int nf = traj_files.size();
+    vector<int> nframes(nf), base(nf), pos(nf);
+    for(int i=0;i<nf;++i){
+        auto trj = Mol_file::open(traj_files[i],'r');
+        if(!trj->get_content_type().rand())
+            throw Pteros_error("Sharded processing requires trajectories with random access, '{}' is not!",traj_files[i]);
+        float t;
+        trj->tell_last_frame_and_time(nframes[i],t);
+        base[i] = (i==0) ? 0 : base[i-1]+nframes[i-1]-1;
+        pos[i] = (i==0) ? 0 : pos[i-1]+nframes[i-1];
+    }
+
+    // Positions of the first and the last frame in range
+    int b = max(first_frame,0);
+    int e = (last_frame>=0) ? last_frame : numeric_limits<int>::max();
+    int pb = -1, pe = -1, fb = -1;
+    for(int i=0;i<nf;++i){
+        if(b<=base[i]+nframes[i]-1){
+            fb = i;
+            pb = pos[i] + max(0,b-base[i]);
+            break;
+        }
+    }
+    for(int i=nf-1;i>=0;--i){
+        if(base[i]<=e){
+            pe = pos[i] + min(e-base[i],nframes[i]-1);
+            break;
+        }
+    }
+
+    // Valid frames are split evenly
+    int step = max(skip,1);
+    int num_valid = (pb>=0 && pe>=pb) ? (pe-pb)/step+1 : 0;
+    shard_begin = (long long)shard_id*num_valid/num_shards;
+    shard_end = (long long)(shard_id+1)*num_valid/num_shards;
+
+    shard_file = 0;
+    shard_file_frame = 0;
+    shard_file_base = 0;
+    if(shard_begin<shard_end){
+        int p = pb + shard_begin*step;
+        for(int i=0;i<nf;++i) if(pos[i]<=p) shard_file = i;
+        shard_file_frame = p - pos[shard_file];
+        shard_file_base = base[shard_file];
+
+        // Frame info refers to the beginning of the whole range
+        range_first_frame = base[fb] + pb - pos[fb];
+        if(custom_dt>=0){
+            range_first_time = custom_start_time + custom_dt*range_first_frame;
+        } else {
+            auto trj = Mol_file::open(traj_files[fb],'r');
+            int fr;
+            trj->seek_frame(pb - pos[fb]);
+            trj->tell_current_frame_and_time(fr,range_first_time);
+        }
+    }
+
+    log->info("Shard {} of {}: valid frames {}:{} of {}",
+              shard_id,num_shards,shard_begin,shard_end-1,num_valid);
+
+    return shard_begin;
+}
+
 void Traj_file_reader::run(const vector<string> &traj_files, const Data_channel_ptr &ch){
     stop_now = false;
     t = std::thread( &Traj_file_reader::reader_thread_body, this, ref(traj_files), ref(ch) );
@@ -122,6 +204,13 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
 
         bool finished = false;
 
+        // Containers of released frames are reused
+        auto pool = Data_container_pool::create(pool_size);
+
+        // Trajectory data are read ahead in background
+        unique_ptr<File_prefetcher> prefetcher;
+        if(prefetch_size>0) prefetcher.reset(new File_prefetcher(prefetch_size));
+
         // Seek status:
         // 0 - don't need to seek
         // 1 - waiting for seeking
@@ -129,10 +218,40 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
         // Check if we need to seek for beginning
         if(first_frame>0 || first_time>0) seek_status = 1;
 
-        for(const string& fname: traj_files){
+        // Shard starts in the middle of the range
+        if(shard_file>=0){
+            if(shard_begin>=shard_end){
+                log->info("Shard is empty");
+                channel->send_stop();
+                return;
+            }
+            seek_status = 0;
+            valid_frame = shard_begin-1;
+            frame_in_range = shard_begin*max(skip,1)-1;
+            first_valid_frame = range_first_frame;
+            first_valid_time = range_first_time;
+        }
+
+        for(int fi=0; fi<int(traj_files.size()); ++fi){
+            // Files before the start of the shard are not read at all
+            if(fi<shard_file) continue;
+
+            const string& fname = traj_files[fi];
             log->info("Reading trajectory {}...", fname);
 
+            if(prefetcher) prefetcher->set_file(fname, fi+1<int(traj_files.size()) ? traj_files[fi+1] : "");
+
             auto trj = Mol_file::open(fname,'r');
+            trj->set_atom_subset(subset);
+
+            // Absolute number of the first frame in this file
+            int file_base = abs_frame;
+
+            if(fi==shard_file){
+                file_base = shard_file_base;
+                trj->seek_frame(shard_file_frame);
+                abs_frame = file_base + shard_file_frame;
+            }
 
             // If we need to seek do it now if trajectory supports it
             if(seek_status==1 && trj->get_content_type().rand()){
@@ -140,20 +259,21 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 float last_t;
                 trj->tell_last_frame_and_time(last_fr,last_t);
                 if(first_frame>0){
-                    // If beyond this trajectory try the next one
-                    if(first_frame>=last_fr){
-                        log->info("First frame is {}, while this trajectory ends at {}.",first_frame,last_fr);
-                        abs_frame += last_fr;
+                    // If beyond this trajectory try the next one.
+                    // Next trajectory starts from the last frame of this one.
+                    if(first_frame>=file_base+last_fr){
+                        log->info("First frame is {}, while this trajectory ends at {}.",first_frame,file_base+last_fr-1);
+                        abs_frame = file_base+last_fr-1;
                         abs_time += last_t;
                         continue;
                     }
                     log->info("Fast forward to frame {}...",first_frame);
-                    trj->seek_frame(first_frame);
+                    trj->seek_frame(first_frame-file_base);
                 } else if(first_time>0){
                     // If beyond this trajectory try the next one
                     if(first_time>=last_t){
-                        log->info("First time is {}, while this trajectory ends at {}.",first_frame,last_fr);
-                        abs_frame += last_fr;
+                        log->info("First time is {}, while this trajectory ends at {}.",first_time,last_t);
+                        abs_frame = file_base+last_fr-1;
                         abs_time += last_t;
                         continue;
                     }
@@ -172,24 +292,32 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
 
             --abs_frame;
 
+            if(prefetcher) prefetcher->set_position(trj->tell_current_offset());
+
             // Main loop over trajectory frames
             while(true){
                 if(stop_now) return;
 
-                // To avoid excessive copy operations we allocate a shared pointer
-                // and will load data into its storage
-                std::shared_ptr<Data_container> data(new Data_container);
+                // To avoid excessive copy operations we take a shared pointer
+                // from the pool and will load data into its storage
+                std::shared_ptr<Data_container> data = pool->get();
 
-                // Load data to this container
-                bool good = trj->read(nullptr, &data->frame, Mol_file_content().traj(true));
+                // Load data to this container. Decoding of coordinates
+                // is deferred to the consumer threads if possible
+                auto t0 = Time_stats::Clock::now();
+                bool good = trj->read_deferred(&data->frame, data->decoder);
+                read_stats.add_since(t0);
 
-                // Check number of atoms
-                if(data->frame.coord.size() != Natoms)
-                    throw Pteros_error("Expected {} atoms but trajectory has {}.",data->frame.coord.size(),Natoms);
+                if(prefetcher) prefetcher->set_position(trj->tell_current_offset());
 
                 // Check if EOF reached in trajectory
                 if(!good) break;
 
+                // Check number of atoms
+                int expected = subset.empty() ? Natoms : subset.size();
+                if(int(data->frame.coord.size()) != expected)
+                    throw Pteros_error("Expected {} atoms but trajectory has {}.",expected,data->frame.coord.size());
+
                 ++abs_frame; // Next absolute frame loaded
 
                 // If time stamps are overriden, override time
@@ -223,6 +351,13 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 // This is valid frame
                 ++valid_frame;
 
+                // Check if the end of shard is reached
+                if(shard_file>=0 && valid_frame>=shard_end){
+                    channel->send_stop();
+                    finished = true;
+                    break;
+                }
+
                 if(valid_frame==0){
                     // This is the very first valid frame, set start time
                     first_valid_frame = abs_frame;
@@ -240,17 +375,25 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 data->frame_info.last_frame = abs_frame;
                 data->frame_info.last_time = abs_time;
 
-                // Send frame to the queue
-                channel->send(data);
+                // Send frame to the queue. It fails if consumers stopped
+                // on corrupted frame.
+                if(!channel->send(data)){
+                    finished = true;
+                    break;
+                }
+
+                if(progress_interval>0 && (valid_frame+1)%progress_interval==0)
+                    progress_callback(valid_frame+1);
 
-                // Do fast-forward skipping if asked
-                if(skip>0){
-                    if(trj->get_content_type().rand() && skip>0){
-                        log->debug("Skipping {} frames by fast-forward...",skip);
+                // Do fast-forward skipping if asked.
+                // Next valid frame is read next, so skip-1 frames are jumped over.
+                if(skip>1){
+                    if(trj->get_content_type().rand()){
+                        log->debug("Skipping {} frames by fast-forward...",skip-1);
                         try {
-                            trj->seek_frame(abs_frame+skip);
-                            abs_frame += skip;
-                            frame_in_range += skip;
+                            trj->seek_frame(abs_frame-file_base+skip);
+                            abs_frame += skip-1;
+                            frame_in_range += skip-1;
                         } catch(Pteros_error e){
                             log->debug("Can't seek, maybe EOF is reached");
                         }
@@ -5,7 +5,10 @@
 #include "pteros/analysis/options.h"
 #include "message_channel.h"
 #include "data_container.h"
+#include "pteros/analysis/pipeline_stats.h"
 #include <thread>
+#include <functional>
+#include <memory>
 
 namespace pteros {
 
@@ -15,12 +18,27 @@ using Data_channel_ptr = std::shared_ptr<Data_channel> ;
 
 class Traj_file_reader {
 public:
-    Traj_file_reader(Options& options, int natoms);
+    /// If atom_subset is not empty only these atoms are read from trajectory
+    Traj_file_reader(Options& options, int natoms, const std::vector<int>& atom_subset = {});
 
     bool is_frame_valid(int fr, float t);
 
     bool is_end_of_interval(int fr, float t);
 
+    /// Restricts reading to one of num_shards consecutive parts of valid frames.
+    /// All trajectories should support random access.
+    /// Returns the number of the first valid frame of this shard.
+    int set_shard(const std::vector<std::string>& traj_files, int num_shards, int shard_id);
+
+    /// Calls given function in reader thread after each interval of valid frames
+    void set_progress_callback(int interval, const std::function<void(int)>& func){
+        progress_interval = interval;
+        progress_callback = func;
+    }
+
+    /// Timings of reading frames
+    Time_stats read_stats;
+
 
     void run(const std::vector<std::string>& traj_files, const Data_channel_ptr& ch);
 
@@ -32,6 +50,7 @@ public:
 
 private:
     int Natoms; // Number of atoms requested in trajectory
+    std::vector<int> subset; // Atoms to read from trajectory
 
     int log_interval;
     float custom_start_time;
@@ -40,6 +59,22 @@ private:
     float first_time, last_time;
     int skip;
 
+    // Shard is started from given frame of given file, which is not seeked
+    // as a usual range, since the first frame of continued trajectory duplicates
+    // the last frame of previous one and has the same absolute number.
+    int shard_file; // -1 if not sharded
+    int shard_file_frame;
+    int shard_file_base; // Absolute number of the first frame of shard_file
+    int shard_begin, shard_end; // Range of valid frames
+    int range_first_frame; // First valid frame of the whole range
+    float range_first_time;
+
+    int progress_interval;
+    std::function<void(int)> progress_callback;
+
+    int64_t prefetch_size; // Bytes read ahead, 0 if disabled
+    int pool_size; // Maximal number of free frames kept for reuse
+
     std::thread t;
     bool stop_now; // Emergency stop flag
     std::shared_ptr<spdlog::logger> log;
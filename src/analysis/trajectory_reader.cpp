@@ -36,7 +36,11 @@
 #include "task_driver.h"
 #include "traj_file_reader.h"
 #include "pteros/core/logging.h"
+#include "pteros/core/thread_pool.h"
 #include <thread>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 
 using namespace pteros;
 using namespace std;
@@ -85,6 +89,31 @@ Processing options:
     -buffer <n>
         Number of frames, which are kept in memory, default: 10
         Only touch this if individual frames are very large.
+    -prefetch <n>
+        Size of the window of trajectory data, which is read ahead in background
+        in MiB, default: 32. The beginning of the next trajectory file is
+        prefetched before the end of the current one. 0 disables prefetching.
+    -nt <n>
+        Number of threads used for parallel processing, default: -1 (all cores)
+        Used by parallel tasks and by internal parallel algorithms.
+    -shards <n>
+        Split processed frames into n consecutive shards, default: 1
+        Each shard is processed by separate run with -shard_id, then the results
+        are merged by the run with -merge_shards true. All tasks should support
+        merging, trajectories should support random access (XTC) and
+        the range should be given in frames.
+    -shard_id <k>
+        Process shard k (0 to n-1) and save partial results of tasks
+    -merge_shards <bool>
+        Merge saved partial results of all shards, default: false
+    -shard_prefix <string>
+        Prefix of files with partial results of shards, default: shard
+        Files are named <prefix>.<k>.state
+    -stats <filename>
+        Stream pipeline statistics to given file as JSON lines, one line
+        each stats_interval frames and the final line at the end
+    -stats_interval <n>
+        Number of frames between the lines of pipeline statistics, default: 100
 
 Suffixes:
     All parameters marked as <value[suffix]> accept the following optional suffixes:
@@ -102,6 +131,33 @@ Suffixes:
 
 
 
+// One line of JSON pipeline statistics
+static string stats_json_line(int frame, double wall, const Traj_file_reader& reader,
+                              const Data_channel& reader_channel,
+                              const vector<shared_ptr<Task_stats>>& task_stats,
+                              const vector<Data_channel_ptr>& worker_channels)
+{
+    auto channel_json = [](const Data_channel& ch){
+        return fmt::format(R"({{"occupancy":{:.3f},"size":{},"send_waits":{},"recieve_waits":{}}})",
+                           ch.mean_occupancy(), ch.get_buffer_size(),
+                           ch.send_waits.to_json(), ch.recieve_waits.to_json());
+    };
+
+    string tasks_json;
+    for(int i=0; i<int(task_stats.size()); ++i){
+        if(i) tasks_json += ",";
+        tasks_json += fmt::format(R"({{"id":{},)",i);
+        if(i<int(worker_channels.size()))
+            tasks_json += fmt::format(R"("channel":{},)",channel_json(*worker_channels[i]));
+        tasks_json += fmt::format(R"("stages":{}}})",task_stats[i]->to_json());
+    }
+
+    return fmt::format(R"({{"frame":{},"wall":{:.3f},"read":{},"reader_channel":{},"tasks":[{}]}})",
+                       frame, wall, reader.read_stats.to_json(),
+                       channel_json(reader_channel), tasks_json);
+}
+
+
 Trajectory_reader::Trajectory_reader()
 {
 
@@ -215,12 +271,63 @@ void Trajectory_reader::run(){
     is_parallel = false;
     for(auto& task: tasks){
         if(task->is_parallel()){
-            if(tasks.size()>1) throw Pteros_error("No other tasks can run if parallel task is present!");
+            if(tasks.size()>1) throw Pteros_error("No other tasks can run if parallel task is present! Use ordered tasks instead.");
             is_parallel = true;
             break;
         }
     }
 
+    // If all tasks declared the atoms they use only the union of them is read
+    vector<int> atom_subset;
+    bool all_declared = true;
+    for(auto& task: tasks){
+        if(task->used_sel_texts.empty() && task->used_ind.empty()) all_declared = false;
+    }
+    if(all_declared){
+        for(auto& task: tasks){
+            for(auto& txt: task->used_sel_texts){
+                Selection sel(system,txt);
+                atom_subset.insert(atom_subset.end(),sel.index_begin(),sel.index_end());
+            }
+            atom_subset.insert(atom_subset.end(),task->used_ind.begin(),task->used_ind.end());
+        }
+        sort(atom_subset.begin(),atom_subset.end());
+        atom_subset.erase(unique(atom_subset.begin(),atom_subset.end()),atom_subset.end());
+
+        if(!atom_subset.empty() && (atom_subset.front()<0 || atom_subset.back()>=system.num_atoms()))
+            throw Pteros_error("Tasks use atoms out of range 0:{}",system.num_atoms()-1);
+
+        if(int(atom_subset.size())==system.num_atoms()) atom_subset.clear();
+    }
+
+    if(!atom_subset.empty()){
+        log->info("Reading {} of {} atoms from trajectory",atom_subset.size(),system.num_atoms());
+        auto frame_atoms = make_shared<const vector<int>>(atom_subset);
+        for(auto& task: tasks) task->frame_atoms = frame_atoms;
+    }
+
+    // Sharded processing
+    int num_shards = options("shards","1").as_int();
+    string shard_prefix = options("shard_prefix","shard").as_string();
+    int shard_id = -1;
+    if(num_shards>1){
+        if(is_parallel) throw Pteros_error("Parallel tasks can't be sharded, use ordered tasks instead!");
+        for(int i=0; i<int(tasks.size()); ++i){
+            if(!tasks[i]->is_mergeable()) throw Pteros_error("Task #{} does not support sharded processing!",i);
+        }
+
+        if(options("merge_shards","false").as_bool()){
+            log->info("Merging results of {} shards", num_shards);
+            merge_shards(num_shards,shard_prefix);
+            log->info("Merging wall time: {}s", chrono::duration<double>(chrono::steady_clock::now()-start).count());
+            return;
+        }
+
+        if(!options.has("shard_id")) throw Pteros_error("Either -shard_id or -merge_shards is required for sharded processing!");
+        shard_id = options("shard_id").as_int();
+        if(shard_id<0 || shard_id>=num_shards) throw Pteros_error("Shard id should be in range 0:{}",num_shards-1);
+    }
+
     // Print summary of files we are going to process
     if(log->level() <= spdlog::level::debug){
         log->debug("Summary of files to be processed:");
@@ -241,12 +348,66 @@ void Trajectory_reader::run(){
     Data_channel_ptr reader_channel(new Data_channel);
     reader_channel->set_buffer_size(buf_size);
 
-    int Nproc = std::thread::hardware_concurrency();
-    log->debug("Physical cores: {}", Nproc);
+    // Set number of threads
+    int nt = options("nt","-1").as_int();
+    if(nt>0) Thread_pool::instance().set_num_threads(nt);
+
+    int Nproc = Thread_pool::instance().get_num_threads();
+    log->debug("Threads: {}", Nproc);
     log->debug("\tFile reading thread: 1");
 
+    // Map stages of ordered tasks share the threads, which are not used by serial tasks
+    int n_ordered = count_if(tasks.begin(),tasks.end(),[](const Task_ptr& t){ return t->is_ordered(); });
+    if(n_ordered){
+        int num_mappers = max(1, (Nproc-int(tasks.size())+n_ordered)/n_ordered);
+        log->debug("\tThreads running map stage of each ordered task: {}", num_mappers);
+        for(auto& task: tasks) task->driver->set_num_mappers(num_mappers);
+    }
+
     // Create traj file reader
-    Traj_file_reader reader(options, system.num_atoms());
+    Traj_file_reader reader(options, system.num_atoms(), atom_subset);
+    if(shard_id>=0){
+        int first_valid = reader.set_shard(traj_files,num_shards,shard_id);
+        for(auto& task: tasks){
+            task->driver->set_first_valid_frame(first_valid);
+            task->driver->set_sharded(true);
+        }
+    }
+
+    // Channels of serial tasks are created in advance to be visible in statistics
+    vector<Data_channel_ptr> worker_channels;
+    if(!is_parallel && tasks.size()>1){
+        // We have to reserve memory for all channels in advance!
+        // Otherwise due to reallocation of array pointers sent to threads may become invalid
+        // which leads to f*cking misterious crashes!
+        worker_channels.reserve(tasks.size());
+        for(int i=0; i<int(tasks.size()); ++i){
+            auto channel=std::make_shared<Data_channel>();
+            channel->set_buffer_size(buf_size);
+            worker_channels.push_back(channel);
+        }
+    }
+
+    // Statistics are shared by all instances of the task, so
+    // it is enough to collect them from original tasks
+    vector<shared_ptr<Task_stats>> task_stats;
+    for(auto& task: tasks) task_stats.push_back(task->pipeline_stats);
+
+    // Streaming of statistics from reader thread
+    ofstream stats_file;
+    if(options.has("stats")){
+        string fname = options("stats").as_string();
+        stats_file.open(fname);
+        if(!stats_file) throw Pteros_error("Can't open file '{}' for writing!",fname);
+        int interval = options("stats_interval","100").as_int();
+        if(interval<1) throw Pteros_error("Stats interval should be positive!");
+        reader.set_progress_callback(interval,[&](int n){
+            stats_file << stats_json_line(n, chrono::duration<double>(chrono::steady_clock::now()-start).count(),
+                                          reader, *reader_channel, task_stats, worker_channels)
+                       << endl;
+        });
+    }
+
     // Start reader thread
     reader.run(traj_files, reader_channel);
 
@@ -280,6 +441,12 @@ void Trajectory_reader::run(){
 
         tasks[0]->set_id(0);
         tasks[0]->driver->set_data_channel_and_system(reader_channel,system);
+        // Each frame goes to only one instance
+        tasks[0]->driver->set_exclusive_frames(true);
+        // Instances take frames in batches, but not more than their share
+        // of the buffer, so that they don't leave each other without work
+        int batch_size = max(1, buf_size/(num_threads+1));
+        tasks[0]->driver->set_batch_size(batch_size);
 
         // Call user-defined init before spawning tasks. System is already set.
         // For parallel tasks jump remover is initialized inside this call
@@ -292,6 +459,8 @@ void Trajectory_reader::run(){
             tasks.emplace_back(tasks[0]->clone());
             tasks[i]->set_id(i);
             tasks[i]->driver->set_data_channel_and_system(reader_channel,system);
+            tasks[i]->driver->set_exclusive_frames(true);
+            tasks[i]->driver->set_batch_size(batch_size);
             tasks[i]->driver->process_until_end_in_thread();
         }
 
@@ -315,14 +484,14 @@ void Trajectory_reader::run(){
         tasks[0]->collect_data(resultive_tasks,n_total);
 
     } else {
-        /* Only serial tasks are present
+        /* Only serial and ordered tasks are present
          * We make individual channels for each worker and feed the same frame
          * to each worker sequensially.
          * Each worker still runs in it's own thread.
+         * Ordered task runs its reduce stage in this thread and spawns
+         * the clones for map stage, which take frames from the same channel.
          */        
 
-        vector<Data_channel_ptr> worker_channels;
-
         if(tasks.size() > 1){
             // More than 1 consumer, start all of them in separate threads
             // Master thread will work as dispatcher
@@ -330,17 +499,7 @@ void Trajectory_reader::run(){
             log->debug("\tRunning {} serial tasks in separate threads", tasks.size());
             log->debug("\t(master thread is dispatching frames)");
 
-            // We have to reserve memory for all channels in advance!
-            // Otherwise due to reallocation of array pointers sent to threads may become invalid
-            // which leads to f*cking misterious crashes!
-            worker_channels.reserve(tasks.size());
-
             for(int i=0; i<tasks.size(); ++i){
-                // Create new channel
-                auto channel=std::make_shared<Data_channel>();
-                channel->set_buffer_size(buf_size);
-                worker_channels.push_back(channel);
-
                 // Configure worker
                 tasks[i]->set_id(i);
                 tasks[i]->driver->set_data_channel_and_system(worker_channels[i],system);
@@ -349,8 +508,14 @@ void Trajectory_reader::run(){
 
             // Recieve all frames for reader channel and dispatch them to workers
             while(reader_channel->recieve(data)){
+                // If all workers stopped on corrupted frame stop the reader too
+                bool sent = false;
                 for(auto &ch: worker_channels){
-                    ch->send(data);
+                    if(ch->send(data)) sent = true;
+                }
+                if(!sent){
+                    reader_channel->send_stop();
+                    break;
                 }
             }
 
@@ -367,6 +532,7 @@ void Trajectory_reader::run(){
             log->debug("\tRunning single serial task in master thread");
             tasks[0]->set_id(0);
             tasks[0]->driver->set_data_channel_and_system(reader_channel,system);
+            tasks[0]->driver->set_exclusive_frames(true);
             tasks[0]->driver->process_until_end();
         }
     } // Dispatching frames
@@ -374,12 +540,21 @@ void Trajectory_reader::run(){
     // Join reader thread
     reader.join();
 
+    if(shard_id>=0) save_shard_state(fmt::format("{}.{}.state",shard_prefix,shard_id));
+
     log->debug("Trajectory processing finished!");
 
     auto end = chrono::steady_clock::now();
 
     log->info("Processing wall time: {}s", chrono::duration<double>(end-start).count() );
 
+    if(stats_file.is_open()){
+        stats_file << stats_json_line(reader_channel->get_num_sent(),
+                                      chrono::duration<double>(end-start).count(),
+                                      reader, *reader_channel, task_stats, worker_channels)
+                   << endl;
+    }
+
     // Print statistics
     if( is_parallel ){
         log->info("Number of frames processed by parallel task instances:");
@@ -395,8 +570,120 @@ void Trajectory_reader::run(){
             log->info("\tTask #{}: {}", i,tasks[i]->n_consumed);
         }
     }
+
+    // Print timings of pipeline stages
+    auto print_channel = [&log](const Data_channel& ch){
+        log->info("\t\tmean occupancy: {:.2f} of {}", ch.mean_occupancy(), ch.get_buffer_size());
+        if(ch.send_waits.count()) log->info("\t\tsend waits: {}", ch.send_waits.summary());
+        if(ch.recieve_waits.count()) log->info("\t\trecieve waits: {}", ch.recieve_waits.summary());
+    };
+
+    log->info("Pipeline statistics:");
+    log->info("\tReading: {}", reader.read_stats.summary());
+    log->info("\tReader channel:");
+    print_channel(*reader_channel);
+    for(int i=0; i<int(task_stats.size()); ++i){
+        const Task_stats& st = *task_stats[i];
+        log->info("\tTask #{}{}:", i, is_parallel ? " (all instances)" : "");
+        const vector<pair<const char*,const Time_stats*>> stages = {
+            {"waiting (idle)",&st.wait}, {"decoding",&st.decode}, {"copying",&st.copy},
+            {"removing jumps",&st.jumps}, {"processing",&st.process}, {"reducing",&st.reduce}
+        };
+        for(auto& stage: stages){
+            if(stage.second->count()) log->info("\t\t{}: {}", stage.first, stage.second->summary());
+        }
+        if(i<int(worker_channels.size())){
+            log->info("\t\tChannel:");
+            print_channel(*worker_channels[i]);
+        }
+    }
 }
 
 
+// Header of files with states of shards
+static const char shard_tag[] = "PTSHARD";
+static const int32_t shard_version = 2;
 
+void Trajectory_reader::save_shard_state(const string &fname)
+{
+    ofstream f(fname,ios::binary);
+    if(!f) throw Pteros_error("Can't open file '{}' for writing!",fname);
 
+    Task_base::write_state_header(f,shard_tag,shard_version,tasks.size());
+    for(auto& task: tasks){
+        const string& state = task->driver->get_state();
+        int32_t n_consumed = task->n_consumed;
+        int64_t sz = state.size();
+        f.write((char*)&n_consumed,sizeof(n_consumed));
+        f.write((char*)&task->driver->get_last_info(),sizeof(Frame_info));
+        f.write((char*)&sz,sizeof(sz));
+        f.write(state.data(),sz);
+    }
+    if(!f) throw Pteros_error("Error writing file '{}'!",fname);
+}
+
+void Trajectory_reader::merge_shards(int num_shards, const string &prefix)
+{
+    // Tasks are initialized as for usual processing.
+    // Structure is already loaded to the first task.
+    const System& system = tasks[0]->system;
+    for(int i=0; i<int(tasks.size()); ++i){
+        tasks[i]->set_id(i);
+        tasks[i]->put_system(system);
+        if(tasks[i]->is_ordered()){
+            tasks[i]->before_spawn_handler();
+        } else {
+            tasks[i]->pre_process_handler();
+        }
+    }
+
+    vector<Frame_info> last_info(tasks.size());
+    for(int k=0; k<num_shards; ++k){
+        string fname = fmt::format("{}.{}.state",prefix,k);
+        ifstream f(fname,ios::binary|ios::ate);
+        if(!f) throw Pteros_error("Can't open file '{}'!",fname);
+        int64_t file_size = f.tellg();
+        f.seekg(0);
+
+        try {
+            int64_t n = Task_base::read_state_header(f,shard_tag,shard_version);
+            if(n!=int64_t(tasks.size())) throw Pteros_error("It has {} tasks instead of {}!",n,tasks.size());
+
+            for(int i=0; i<int(tasks.size()); ++i){
+                int32_t n_consumed;
+                Frame_info info;
+                int64_t sz;
+                f.read((char*)&n_consumed,sizeof(n_consumed));
+                f.read((char*)&info,sizeof(Frame_info));
+                f.read((char*)&sz,sizeof(sz));
+                if(!f) throw Pteros_error("State of task #{} is truncated!",i);
+                if(n_consumed<0 || sz<0 || sz>file_size) throw Pteros_error("State of task #{} is corrupted!",i);
+                string state(sz,'\0');
+                f.read(&state[0],sz);
+                if(!f) throw Pteros_error("State of task #{} is truncated!",i);
+
+                // Empty shards have nothing to merge
+                if(n_consumed==0) continue;
+
+                // Task should read exactly what it has written
+                istringstream in(state);
+                tasks[i]->merge_state(in);
+                if(in.fail() || in.peek()!=EOF) throw Pteros_error("Task #{} read its state incorrectly!",i);
+                tasks[i]->n_consumed += n_consumed;
+                last_info[i] = info;
+            }
+            if(f.peek()!=EOF) throw Pteros_error("There is extra data after the states of tasks!");
+        } catch(const Pteros_error& e) {
+            throw Pteros_error("Error merging shard '{}': {}",fname,e.what());
+        }
+    }
+
+    for(int i=0; i<int(tasks.size()); ++i){
+        if(tasks[i]->n_consumed>0){
+            tasks[i]->log->info("Merged {} frames", tasks[i]->n_consumed);
+            tasks[i]->post_process_handler(last_info[i]);
+        } else {
+            tasks[i]->log->warn("No frames consumed!");
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#ifndef ATOMIC_BITSET_H_INCLUDED
+#define ATOMIC_BITSET_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+namespace pteros {
+
+// Packed array of bits, which could be set concurrently from many threads.
+// Relaxed ordering is used since bits are only read after all threads are joined.
+class Atomic_bitset {
+public:
+    Atomic_bitset(): n_bits(0), n_words(0) {}
+
+    // Resize and clear all bits
+    void resize(int n){
+        int nw = (n+63)/64;
+        if(nw>n_words){
+            words.reset(new std::atomic<uint64_t>[nw]);
+            n_words = nw;
+        }
+        n_bits = n;
+        for(int i=0;i<nw;++i) words[i].store(0,std::memory_order_relaxed);
+    }
+
+    int size() const { return n_bits; }
+    int num_words() const { return (n_bits+63)/64; }
+
+    bool test(int i) const {
+        return (words[i>>6].load(std::memory_order_relaxed) >> (i&63)) & 1;
+    }
+
+    void set(int i){
+        words[i>>6].fetch_or(uint64_t(1) << (i&63), std::memory_order_relaxed);
+    }
+
+    uint64_t word(int w) const {
+        return words[w].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    int n_bits, n_words;
+};
+
+}
+
+#endif
+
@@ -29,6 +29,7 @@
 
 
 #include "distance_search_base.h"
+#include "pteros/core/pteros_error.h"
 
 using namespace std;
 using namespace pteros;
@@ -68,23 +69,26 @@ void Distance_search_base::set_grid_size(const Vector3f &min, const Vector3f &ma
         if(dZ<cutoff) NgridZ = floor(extZ/cutoff);
         */
 
-    // See if some of grid vectors projected to lab axes smaller than cutoff
-    //TODO: This need to be refactored to get rid of the while loop and to
-    // compute optimal size in one operation.
     if(is_periodic) {
-
-        while(box.box_to_lab(Vector3f(dX,0.0,0.0))(0) < cutoff && NgridX>1){
-            --NgridX;
-            dX = (max(0)-min(0))/NgridX;
-        }
-        while(box.box_to_lab(Vector3f(0.0,dY,0.0))(1) < cutoff && NgridY>1){
-            --NgridY;
-            dY = (max(1)-min(1))/NgridY;
-        }
-        while(box.box_to_lab(Vector3f(0.0,0.0,dZ))(2) < cutoff && NgridZ>1){
-            --NgridZ;
-            dZ = (max(2)-min(2))/NgridZ;
-        }
+        // Grid is built in fractional coordinates of the box. Each cell
+        // should be at least cutoff thick in the direction normal to its faces,
+        // so that all neighbours are in adjacent cells even for triclinic boxes.
+        Matrix3f m = box.get_matrix();
+        Vector3f bc = m.col(1).cross(m.col(2));
+        Vector3f ca = m.col(2).cross(m.col(0));
+        Vector3f ab = m.col(0).cross(m.col(1));
+        float V = std::abs(m.col(0).dot(bc));
+        Vector3f h(V/bc.norm(), V/ca.norm(), V/ab.norm());
+
+        // If cutoff exceeds half of the box height several periodic images of
+        // the same atom could be within cutoff and pairs would be reported more than once
+        if(2.0*cutoff > h.minCoeff())
+            throw Pteros_error("Periodic distance search with cutoff {} requires the box height of at least {}, but it is {}!",
+                               cutoff, 2.0*cutoff, h.minCoeff());
+
+        NgridX = std::max(1, std::min(NgridX, int(floor(h(0)/cutoff))));
+        NgridY = std::max(1, std::min(NgridY, int(floor(h(1)/cutoff))));
+        NgridZ = std::max(1, std::min(NgridZ, int(floor(h(2)/cutoff))));
 
     } else { // No projection needed since there is no box
 
@@ -104,70 +108,68 @@ void Distance_search_base::set_grid_size(const Vector3f &min, const Vector3f &ma
     }
 }
 
-void Distance_search_base::get_nlist(int i, int j, int k, Nlist_t &nlist)
+void Distance_search_base::set_image_shifts()
 {
+    if(!is_periodic) return;
+    Matrix3f m = box.get_matrix();
+    for(int n1=-1;n1<=1;++n1)
+        for(int n2=-1;n2<=1;++n2)
+            for(int n3=-1;n3<=1;++n3)
+                image_shifts[(n1+1)*9+(n2+1)*3+n3+1] = m*Vector3f(n1,n2,n3);
+}
+
+bool Distance_search_base::locate_point(Vector3f_const_ref point, Vector3i &cell, Vector3f &wrapped) const
+{
+    Vector3i dims(NgridX,NgridY,NgridZ);
+    if(is_periodic){
+        // Same binning as in Grid::populate_periodic()
+        Vector3f s = box.get_inv_matrix()*point;
+        for(int d=0;d<3;++d){
+            s(d) -= floor(s(d));
+            cell(d) = std::min(std::max(int(floor(dims(d)*s(d))),0),dims(d)-1);
+        }
+        wrapped = box.get_matrix()*s;
+    } else {
+        for(int d=0;d<3;++d){
+            cell(d) = floor(dims(d)*(point(d)-min(d))/(max(d)-min(d)));
+            if(cell(d)<0 || cell(d)>=dims(d)) return false;
+        }
+        wrapped = point;
+    }
+    return true;
+}
 
+void Distance_search_base::get_nlist(int i, int j, int k, Nlist_t &nlist, bool half)
+{
     nlist.clear();
 
-    Vector3i coor;
-
-    if(!is_periodic){
-        int c1,c2,c3;
-        // Non-periodic variant
-        for(c1=-1; c1<=1; ++c1){
-            coor(0) = i+c1;
-            if(coor(0)<0 || coor(0)>=NgridX) continue; // Bounds check
-            for(c2=-1; c2<=1; ++c2){
-                coor(1) = j+c2;
-                if(coor(1)<0 || coor(1)>=NgridY) continue; // Bounds check
-                for(c3=-1; c3<=1; ++c3){
-                    coor(2) = k+c3;
-                    if(coor(2)<0 || coor(2)>=NgridZ) continue; // Bounds check
-                    //Exclude central cell
-                    if(coor(0) == i && coor(1) == j && coor(2) == k ) continue;
-                    // Add cell
+    Vector3i coor, n;
+    Vector3i c(i,j,k);
+    Vector3i dims(NgridX,NgridY,NgridZ);
+    int c1,c2,c3,d;
+
+    for(c1=-1; c1<=1; ++c1){
+        for(c2=-1; c2<=1; ++c2){
+            for(c3=-1; c3<=1; ++c3){
+                // Exclude central cell
+                if(c1==0 && c2==0 && c3==0) continue;
+                // For half shell only take offsets with first non-zero component positive
+                if(half && (c1<0 || (c1==0 && (c2<0 || (c2==0 && c3<0))))) continue;
+
+                coor = c + Vector3i(c1,c2,c3);
+
+                if(!is_periodic){
+                    // Bounds check
+                    if((coor.array()<0).any() || (coor.array()>=dims.array()).any()) continue;
                     nlist.append(coor);
-                }
-            }
-        }
-    } else {
-        // Periodic variant
-        int bX = 0, eX = 0;
-        int bY = 0, eY = 0;
-        int bZ = 0, eZ = 0;
-
-        // If the number of cells in dimension is 2 this is a special case
-        // when only one neighbour is need. Otherwise add both.
-        if(NgridX>1) bX = -1;
-        if(NgridY>1) bY = -1;
-        if(NgridZ>1) bZ = -1;
-
-        if(NgridX>2) eX = 1;
-        if(NgridY>2) eY = 1;
-        if(NgridZ>2) eZ = 1;
-
-        int c1,c2,c3;
-        bool wrap1,wrap2,wrap3;
-
-        for(c1 = bX; c1<=eX; ++c1){
-            wrap1 = false;
-            coor(0) = i+c1;
-            if(coor(0)==NgridX){ coor(0) = 0; wrap1=true; }
-            if(coor(0)==-1){ coor(0) = NgridX-1; wrap1=true; }
-            for(c2 = bY; c2<=eY; ++c2){
-                wrap2 = false;
-                coor(1) = j+c2;
-                if(coor(1)==NgridY){ coor(1) = 0; wrap2=true; }
-                if(coor(1)==-1){ coor(1) = NgridY-1; wrap2=true; }
-                for(c3 = bZ; c3<=eZ; ++c3){
-                    wrap3 = false;
-                    coor(2) = k+c3;
-                    if(coor(2)==NgridZ){ coor(2) = 0; wrap3=true; }
-                    if(coor(2)==-1){ coor(2) = NgridZ-1; wrap3=true; }
-                    //Exclude central cell
-                    if(coor(0) == i && coor(1) == j && coor(2) == k) continue;
-                    // Add cell
-                    nlist.append(coor, wrap1||wrap2||wrap3);
+                } else {
+                    // Wrap cell and remember which periodic image it corresponds to
+                    for(d=0;d<3;++d){
+                        n(d) = 0;
+                        if(coor(d)>=dims(d)){ coor(d) -= dims(d); n(d) = 1; }
+                        else if(coor(d)<0){ coor(d) += dims(d); n(d) = -1; }
+                    }
+                    nlist.append(coor, image_shifts[(n(0)+1)*9+(n(1)+1)*3+n(2)+1]);
                 }
             }
         }
@@ -177,13 +179,11 @@ void Distance_search_base::get_nlist(int i, int j, int k, Nlist_t &nlist)
 void Nlist_t::clear()
 {
     data.clear();
-    wrapped.clear();
+    shift.clear();
 }
 
-void Nlist_t::append(Vector3i_const_ref coor, bool wrap)
+void Nlist_t::append(Vector3i_const_ref coor, Vector3f_const_ref sh)
 {
     data.push_back(coor);
-    wrapped.push_back(wrap);
+    shift.push_back(sh);
 }
-
-
@@ -35,15 +35,18 @@
 #include <vector>
 #include "pteros/core/periodic_box.h"
 #include "pteros/core/grid.h"
+#include "pair_kernels.h"
 
 namespace pteros {       
 
+    // List of neighbour cells. For each cell the shift of its periodic image
+    // is stored. It has to be added to the coordinates of the atoms in that cell.
     struct Nlist_t {
         std::vector<Eigen::Vector3i> data;
-        std::vector<bool> wrapped;
+        std::vector<Eigen::Vector3f> shift;
 
         void clear();
-        void append(Vector3i_const_ref coor, bool wrap = false);
+        void append(Vector3i_const_ref coor, Vector3f_const_ref sh = Eigen::Vector3f::Zero());
     };
 
 
@@ -64,12 +67,24 @@ namespace pteros {
         bool abs_index;
         // Periodicity
         bool is_periodic;
+        // Precomputed box and cutoff for pair kernels
+        Pair_kernel_params kernel_prm;
 
         void set_grid_size(const Eigen::Vector3f& min, const Eigen::Vector3f& max,
                            int Natoms, const Periodic_box& box);
 
 
-        void get_nlist(int i, int j, int k, Nlist_t &nlist);
+        // Shifts of periodic images for all combinations of -1,0,1 box vectors
+        Eigen::Vector3f image_shifts[27];
+        void set_image_shifts();
+
+        // Find the grid cell of arbitrary point. In periodic case the point is
+        // wrapped into the box. Returns false if the point is outside the grid.
+        bool locate_point(Vector3f_const_ref point, Eigen::Vector3i& cell, Eigen::Vector3f& wrapped) const;
+
+        // Get neighbour cells. If half is true only half of the stencil is returned,
+        // so that each pair of cells is visited once.
+        void get_nlist(int i, int j, int k, Nlist_t &nlist, bool half = false);
     };
 
 }
@@ -0,0 +1,252 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+#include "pteros/core/distance_search_batch.h"
+#include "pteros/core/distance_search.h"
+#include "pteros/core/pteros_error.h"
+#include "pteros/core/system.h"
+#include <cstdint>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+
+class Distance_search_batch::Distance_search_batch_impl {
+public:
+    Distance_search_batch_impl(bool absolute_index, bool periodic):
+        abs_index(absolute_index), is_periodic(periodic) {}
+
+    int add_query(float d, const Selection* sel1, const Selection* sel2){
+        if(queries.size()==64) throw Pteros_error("No more than 64 queries are allowed in distance search batch!");
+        if(d<=0) throw Pteros_error("Cutoff of distance search query should be positive!");
+        if(sel1->get_system()==nullptr || (sel2 && sel2->get_system()==nullptr))
+            throw Pteros_error("Selections of distance search query are not set!");
+        if(queries.size() && sel1->get_system()!=queries[0].sel1->get_system())
+            throw Pteros_error("All selections in distance search batch should belong to the same system!");
+        if(sel2 && sel2->get_system()!=sel1->get_system())
+            throw Pteros_error("All selections in distance search batch should belong to the same system!");
+
+        queries.push_back({d,sel1,sel2});
+        pairs.emplace_back();
+        distances.emplace_back();
+        return queries.size()-1;
+    }
+
+    void clear(){
+        queries.clear();
+        pairs.clear();
+        distances.clear();
+    }
+
+    void search(){
+        int nq = queries.size();
+        if(nq==0) return;
+
+        for(int q=0;q<nq;++q){
+            pairs[q].clear();
+            distances[q].clear();
+        }
+
+        System* sys = queries[0].sel1->get_system();
+        int fr = queries[0].sel1->get_frame();
+
+        //----------------------------------------
+        // Union of all selections
+        //----------------------------------------
+        all_ind.clear();
+        for(auto& q: queries){
+            all_ind.insert(all_ind.end(),q.sel1->index_begin(),q.sel1->index_end());
+            if(q.sel2) all_ind.insert(all_ind.end(),q.sel2->index_begin(),q.sel2->index_end());
+        }
+        sort(all_ind.begin(),all_ind.end());
+        all_ind.erase(unique(all_ind.begin(),all_ind.end()),all_ind.end());
+        int N = all_ind.size();
+        if(N==0) return;
+
+        // Position of each atom in the union
+        pos.resize(sys->num_atoms());
+        for(int i=0;i<N;++i) pos[all_ind[i]] = i;
+
+        //----------------------------------------
+        // Membership masks. Bit q is set if atom belongs to sel1 (mask1)
+        // or to sel2 (mask2) of query q
+        //----------------------------------------
+        mask1.assign(N,0);
+        mask2.assign(N,0);
+        uint64_t single = 0; // Queries within single selection
+        for(int q=0;q<nq;++q){
+            uint64_t bit = uint64_t(1)<<q;
+            const Selection& s1 = *queries[q].sel1;
+            for(int i=0;i<s1.size();++i) mask1[pos[s1.index(i)]] |= bit;
+            if(queries[q].sel2){
+                const Selection& s2 = *queries[q].sel2;
+                for(int i=0;i<s2.size();++i) mask2[pos[s2.index(i)]] |= bit;
+            } else {
+                single |= bit;
+            }
+        }
+
+        //----------------------------------------
+        // Distance bins. Queries are sorted by cutoff and the pair
+        // with distance d goes to all queries with cutoff>=d.
+        //----------------------------------------
+        vector<int> order(nq);
+        for(int q=0;q<nq;++q) order[q] = q;
+        sort(order.begin(),order.end(),[this](int a, int b){ return queries[a].cutoff<queries[b].cutoff; });
+        // bin_mask[i] has the bits of queries order[i..nq)
+        vector<float> bin_cut(nq);
+        vector<uint64_t> bin_mask(nq+1,0);
+        for(int i=nq-1;i>=0;--i){
+            bin_cut[i] = queries[order[i]].cutoff;
+            bin_mask[i] = bin_mask[i+1] | (uint64_t(1)<<order[i]);
+        }
+
+        //----------------------------------------
+        // Single search with max cutoff
+        //----------------------------------------
+        Selection all(*sys,all_ind);
+        all.set_frame(fr);
+        pteros::search_contacts(bin_cut[nq-1],all,found,false,is_periodic,&found_dist);
+
+        //----------------------------------------
+        // Dispatch pairs to queries
+        //----------------------------------------
+        for(int k=0;k<int(found.size());++k){
+            int a = found[k](0);
+            int b = found[k](1);
+            float d = found_dist[k];
+
+            int i = 0;
+            while(bin_cut[i]<d) ++i; // d<=max cutoff, so this always stops
+            uint64_t m = bin_mask[i];
+
+            dispatch(m & single & mask1[a] & mask1[b], a, b, d);
+            dispatch(m & ~single & mask1[a] & mask2[b], a, b, d);
+            dispatch(m & ~single & mask1[b] & mask2[a], b, a, d);
+        }
+
+        // Atoms present in both selections of the query are in contact with themselves
+        for(int a=0;a<N;++a) dispatch(~single & mask1[a] & mask2[a], a, a, 0.0);
+
+        //----------------------------------------
+        // Convert indexes
+        //----------------------------------------
+        for(int q=0;q<nq;++q){
+            const Selection& s1 = *queries[q].sel1;
+            const Selection& s2 = queries[q].sel2 ? *queries[q].sel2 : s1;
+            for(auto& pr: pairs[q]){
+                pr(0) = all_ind[pr(0)];
+                pr(1) = all_ind[pr(1)];
+                if(!abs_index){
+                    pr(0) = lower_bound(s1.index_begin(),s1.index_end(),pr(0)) - s1.index_begin();
+                    pr(1) = lower_bound(s2.index_begin(),s2.index_end(),pr(1)) - s2.index_begin();
+                }
+            }
+        }
+    }
+
+    struct Query {
+        float cutoff;
+        const Selection* sel1;
+        const Selection* sel2; // nullptr for single selection
+    };
+
+    vector<Query> queries;
+    vector<vector<Vector2i>> pairs;
+    vector<vector<float>> distances;
+
+private:
+    bool abs_index, is_periodic;
+    // Sorted indexes of all atoms
+    vector<int> all_ind;
+    // Position in all_ind for each atom of the system
+    vector<int> pos;
+    vector<uint64_t> mask1, mask2;
+    // Raw results of the search in the union
+    vector<Vector2i> found;
+    vector<float> found_dist;
+
+    void dispatch(uint64_t m, int a, int b, float d){
+        while(m){
+            int q = __builtin_ctzll(m);
+            pairs[q].emplace_back(a,b);
+            distances[q].push_back(d);
+            m &= m-1;
+        }
+    }
+};
+
+
+Distance_search_batch::Distance_search_batch(bool absolute_index, bool periodic)
+{
+    p = unique_ptr<Distance_search_batch_impl>(new Distance_search_batch_impl(absolute_index,periodic));
+}
+
+Distance_search_batch::~Distance_search_batch()
+{
+
+}
+
+int Distance_search_batch::add_query(float d, const Selection &sel)
+{
+    return p->add_query(d,&sel,nullptr);
+}
+
+int Distance_search_batch::add_query(float d, const Selection &sel1, const Selection &sel2)
+{
+    return p->add_query(d,&sel1,&sel2);
+}
+
+void Distance_search_batch::clear()
+{
+    p->clear();
+}
+
+int Distance_search_batch::num_queries() const
+{
+    return p->queries.size();
+}
+
+void Distance_search_batch::search()
+{
+    p->search();
+}
+
+const std::vector<Vector2i> &Distance_search_batch::get_pairs(int q) const
+{
+    if(q<0 || q>=int(p->queries.size())) throw Pteros_error("Invalid query id {}!",q);
+    return p->pairs[q];
+}
+
+const std::vector<float> &Distance_search_batch::get_distances(int q) const
+{
+    if(q<0 || q>=int(p->queries.size())) throw Pteros_error("Invalid query id {}!",q);
+    return p->distances[q];
+}
+
@@ -29,106 +29,60 @@
 
 
 #include "distance_search_contacts.h"
-#include <thread>
+#include "pteros/core/thread_pool.h"
 
 using namespace std;
 using namespace pteros;
 using namespace Eigen;
 
 void Distance_search_contacts::do_search(){
-    int i,j,k,i1;
-    int nlist_size;
+    // Periodicity is handled by the image shifts of neighbour cells,
+    // so kernels never apply minimum image
+    kernel_prm.setup(cutoff,box,false);
+    set_image_shifts();
 
     // Search
     result_pairs->clear();
     if(result_distances) result_distances->clear();
 
-    // Init visited cells array
-    for(i=0;i<NgridX;++i)
-        for(j=0;j<NgridY;++j)
-            for(k=0;k<NgridZ;++k){
-                visited[i][j][k] = false;
-            }
-
-    // See if we need parallelization
-    int max_N, max_dim;
-    Vector3i dims(NgridX,NgridY,NgridZ);
-    max_N = dims.maxCoeff(&max_dim);
-
-    int nt = std::min(max_N, int(std::thread::hardware_concurrency()));
-
-    if(nt==1){
-        deque<Vector2i> _bon;
-        deque<float> _dist_vec;
-        deque<float>* _dist_vec_ptr;
-        _dist_vec_ptr = result_distances ? &_dist_vec : nullptr;
-
-        do_part(0,0,NgridX,_bon,_dist_vec_ptr);
-
-        // Collect results
-        result_pairs->reserve(_bon.size());
-
-        copy(_bon.begin(),_bon.end(),back_inserter(*result_pairs));
-
-        if(result_distances){
-            result_distances->reserve(_dist_vec.size());
-            copy(_dist_vec.begin(),_dist_vec.end(),back_inserter(*result_distances));
-        }
-
-    } else {
-        // Parallel searching
-
-        // Determine parts for each thread
-        vector<int> b(nt),e(nt);
-        int cur=0;
-        for(int i=0;i<nt-1;++i){
-            b[i]=cur;
-            cur += dims(max_dim)/nt;
-            e[i]=cur;
-        }
-        b[nt-1]=cur;
-        e[nt-1]=dims(max_dim);
-
-        // Prepare arrays per each thread
-        vector< deque<Vector2i> > _bon(nt);
-        vector< deque<float> > _dist_vec(nt);
-        vector< deque<float>* > _dist_vec_ptr(nt);
-        for(int i=0;i<nt;++i) _dist_vec_ptr[i] = result_distances ? &_dist_vec[i] : nullptr;
-
-        // Launch threads
-        vector<thread> threads;
-        for(int i=0;i<nt;++i){
-            threads.emplace_back(
-                                   std::bind(
-                                       &Distance_search_contacts::do_part,
-                                       this,
-                                       max_dim,
-                                       b[i],
-                                       e[i],
-                                       ref(_bon[i]),
-                                       ref(_dist_vec_ptr[i])
-                                   )                                
-                             );
+    auto& pool = Thread_pool::instance();
+
+    // Cells are processed in chunks, which are distributed between the threads dynamically.
+    // Each chunk has its own result buffer, so the order of results does not
+    // depend on the number of threads.
+    int Ncells = NgridX*NgridY*NgridZ;
+    int chunk = std::max(1, Ncells/(8*pool.get_num_threads()));
+    int Nchunks = (Ncells+chunk-1)/chunk;
+
+    vector< vector<Vector2i> > _bon(Nchunks);
+    vector< vector<float> > _dist_vec(Nchunks);
+
+    pool.parallel_for(Ncells, chunk, [&](int b, int e, int th){
+        int n = b/chunk;
+        vector<float>* _dist_vec_ptr = result_distances ? &_dist_vec[n] : nullptr;
+        for(int c=b;c<e;++c){
+            int i = c/(NgridY*NgridZ);
+            int j = (c/NgridZ)%NgridY;
+            int k = c%NgridZ;
+            do_cell(i,j,k,_bon[n],_dist_vec_ptr);
         }
+    });
 
-        // Wait for threads
-        for(auto& t: threads) t.join();
+    // Collect results. Offsets of chunks are found by prefix sum
+    // and then chunks are copied in parallel.
+    vector<int> offset(Nchunks+1,0);
+    for(int i=0;i<Nchunks;++i) offset[i+1] = offset[i] + _bon[i].size();
 
-        // Collect results
-        int sz = 0;
-        for(int i=0;i<nt;++i) sz+= _bon[i].size();
+    result_pairs->resize(offset[Nchunks]);
+    if(result_distances) result_distances->resize(offset[Nchunks]);
 
-        result_pairs->reserve(sz);
-        for(int i=0;i<nt;++i){
-            copy(_bon[i].begin(),_bon[i].end(),back_inserter(*result_pairs));
+    pool.parallel_for(Nchunks, 1, [&](int b, int e, int th){
+        for(int i=b;i<e;++i){
+            copy(_bon[i].begin(),_bon[i].end(),result_pairs->begin()+offset[i]);
+            if(result_distances)
+                copy(_dist_vec[i].begin(),_dist_vec[i].end(),result_distances->begin()+offset[i]);
         }
-
-        if(result_distances){
-            result_distances->reserve(sz);
-            for(int i=0;i<nt;++i)
-                copy(_dist_vec[i].begin(),_dist_vec[i].end(),back_inserter(*result_distances));
-        }
-    }
+    });
 }
 
 
@@ -136,51 +90,43 @@ void Distance_search_contacts::search_in_pair_of_cells(int x1, int y1, int z1, /
                              int x2, int y2, int z2, // cell 2
                              Grid& grid1,
                              Grid& grid2,
-                             deque<Vector2i>& bon,
-                             deque<float>* dist_vec, bool is_periodic)
+                             vector<Vector2i>& bon,
+                             vector<float>* dist_vec,
+                             Vector3f_const_ref shift)
 {
-    int N1,N2,ind1,ind2,i1,i2;
-    float d;
-    float cutoff2 = cutoff*cutoff;
+    int N1,N2,ind1,i1,k,n;
 
-    N1 = grid1.cell(x1,y1,z1).size();
-    N2 = grid2.cell(x2,y2,z2).size();
+    const Grid_cell v1 = grid1.cell(x1,y1,z1);
+    const Grid_cell v2 = grid2.cell(x2,y2,z2);
+
+    N1 = v1.size();
+    N2 = v2.size();
 
     if(N1*N2==0) return; // Nothing to do
 
-    const vector<Grid_element>& v1 = grid1.cell(x1,y1,z1);
-    const vector<Grid_element>& v2 = grid2.cell(x2,y2,z2);
-
-    if(is_periodic){
-
-        for(i1=0;i1<N1;++i1){
-            Vector3f* p = v1[i1].coor_ptr; // Coord of point in grid1
-            for(i2=0;i2<N2;++i2){
-                d = box.distance_squared(*(v2[i2].coor_ptr),*p);
-                if(d<=cutoff2){
-                    ind1 = v1[i1].index; //index
-                    ind2 = v2[i2].index; //index
-                    bon.emplace_back(ind1,ind2);
-                    if(dist_vec) dist_vec->push_back(sqrt(d));
-                }
-            }
-        }
+    // Per-thread buffers for kernel output
+    static thread_local vector<int> found;
+    static thread_local vector<float> found_d2;
+    if(int(found.size())<N2){
+        found.resize(N2);
+        found_d2.resize(N2);
+    }
 
-    } else {
-
-        for(i1=0;i1<N1;++i1){
-            Vector3f* p = v1[i1].coor_ptr; // Coord of point in grid1
-            for(i2=0;i2<N2;++i2){
-                d = (*(v2[i2].coor_ptr)-*p).squaredNorm();
-                if(d<=cutoff2){
-                    ind1 = v1[i1].index; //index
-                    ind2 = v2[i2].index; //index
-                    bon.emplace_back(ind1,ind2);
-                    if(dist_vec) dist_vec->push_back(sqrt(d));
-                }
-            }
+    // The same cell of the same grid is only searched against its periodic image
+    // if the grid is one cell wide. An atom is never paired with its own image.
+    bool same = (&grid1==&grid2) && v1.x==v2.x;
+
+    for(i1=0;i1<N1;++i1){
+        // Shifting point in grid1 back is the same as shifting the image of cell 2
+        n = find_within(kernel_prm, false,
+                        v1.x[i1]-shift(0), v1.y[i1]-shift(1), v1.z[i1]-shift(2),
+                        v2, 0, found.data(), found_d2.data());
+        ind1 = v1.ind[i1]; //index
+        for(k=0;k<n;++k){
+            if(same && found[k]==i1) continue;
+            bon.emplace_back(ind1,v2.ind[found[k]]);
+            if(dist_vec) dist_vec->push_back(sqrt(found_d2[k]));
         }
-
     }
 }
 
@@ -38,24 +38,24 @@ namespace pteros {
 class Distance_search_contacts: public Distance_search_base {
 public:
 protected:
-    // wisited array
-    boost::multi_array<bool, 3> visited;
     // Pointers for final results
     std::vector<Eigen::Vector2i>* result_pairs;
     std::vector<float>* result_distances;
 
     void do_search();
-    virtual void do_part(int dim, int _b, int _e,
-                         std::deque<Eigen::Vector2i>& bon,
-                         std::deque<float>* dist_vec) = 0;
+    // Search around single cell. Only half of neighbour cells are considered,
+    // so each pair of cells is visited once.
+    virtual void do_cell(int i, int j, int k,
+                         std::vector<Eigen::Vector2i>& bon,
+                         std::vector<float>* dist_vec) = 0;
 
     void search_in_pair_of_cells(int x1, int y1, int z1,
                                  int x2, int y2, int z2,
                                  Grid &grid1,
                                  Grid &grid2,
-                                 std::deque<Eigen::Vector2i> &bon,
-                                 std::deque<float> *dist_vec,
-                                 bool is_periodic);
+                                 std::vector<Eigen::Vector2i> &bon,
+                                 std::vector<float> *dist_vec,
+                                 Vector3f_const_ref shift);
 };
 
 }
@@ -30,7 +30,6 @@
 
 #include "distance_search_contacts_1sel.h"
 #include "pteros/core/pteros_error.h"
-#include <thread>
 
 using namespace std;
 using namespace pteros;
@@ -78,115 +77,60 @@ void Distance_search_contacts_1sel::create_grid(const Selection &sel)
     set_grid_size(min,max, sel.size(), box);
     // Allocate one grid
     grid1.resize(NgridX,NgridY,NgridZ);
-    // Allocate visited array
-    visited.resize( boost::extents[NgridX][NgridY][NgridZ] );
 }
 
-void Distance_search_contacts_1sel::do_part(int dim, int _b, int _e, std::deque<Vector2i> &bon, std::deque<float> *dist_vec)
+void Distance_search_contacts_1sel::do_cell(int i, int j, int k, std::vector<Vector2i> &bon, std::vector<float> *dist_vec)
 {
-    Vector3i b(0,0,0);
-    Vector3i e(NgridX,NgridY,NgridZ);
-    int dim_max = e(dim);
-    b(dim)= _b;
-    e(dim)= _e;
-    int i,j,k,i1,nlist_size;
-    Nlist_t nlist; // Local nlist
-
-    float cutoff2 = cutoff*cutoff;
-
-    for(i=b(0);i<e(0);++i){
-        for(j=b(1);j<e(1);++j){
-            for(k=b(2);k<e(2);++k){
-                // Search in central cell
-                //get_central_1(i,j,k, sel, bon, dist_vec);
-                search_in_cell(i,j,k,bon,dist_vec,false);
-                visited[i][j][k] = true;
-                // Get neighbour list locally
-                get_nlist(i,j,k,nlist);
-                nlist_size = nlist.data.size();
-                // Search between this and neighbouring cells
-                for(i1=0;i1<nlist_size;++i1){
-                    const Vector3i& cell = nlist.data[i1];
-                    // If the neighbour is "at left" from the boundary of this part,
-                    // ignore it. Only consider dim dimension.
-                    if(cell(dim)<b(dim)){
-                        continue;
-                    }
-
-                    // We only check for visited cells inside local part, not in the "halo"
-                    if(    cell(dim)>=b(dim)
-                        && cell(dim)<e(dim) ){
-                        // cell is inside the partition
-                        if( !visited[cell(0)][cell(1)][cell(2)] )
-                            search_in_pair_of_cells(i,j,k,
-                                                    cell(0),cell(1),cell(2),
-                                                    grid1, grid1,
-                                                    bon,dist_vec,
-                                                    nlist.wrapped[i1] && is_periodic);
-                    } else {
-                        // cell is in halo
-                        search_in_pair_of_cells(i,j,k,
-                                                cell(0),cell(1),cell(2),
-                                                grid1, grid1,
-                                                bon,dist_vec,
-                                                nlist.wrapped[i1] && is_periodic);
-                    }
-
-
-                }
-
-            }
-        }
+    static thread_local Nlist_t nlist; // Local nlist
+    int i1, nlist_size;
+
+    // Search in central cell
+    search_in_cell(i,j,k,bon,dist_vec);
+    // Get half of neighbour list locally
+    get_nlist(i,j,k,nlist,true);
+    nlist_size = nlist.data.size();
+    // Search between this and neighbouring cells
+    for(i1=0;i1<nlist_size;++i1){
+        const Vector3i& cell = nlist.data[i1];
+        search_in_pair_of_cells(i,j,k,
+                                cell(0),cell(1),cell(2),
+                                grid1, grid1,
+                                bon,dist_vec,
+                                nlist.shift[i1]);
     }
 }
 
 void Distance_search_contacts_1sel::search_in_cell(int x, int y, int z,
-                    deque<Vector2i>& bon,
-                    deque<float>* dist_vec,
-                    bool is_periodic)
+                    vector<Vector2i>& bon,
+                    vector<float>* dist_vec)
     {
-    int N,ind1,ind2,i1,i2;
-    float d;
-    float cutoff2 = cutoff*cutoff;
+    int N,ind1,i1,k,n;
+
+    const Grid_cell v = grid1.cell(x,y,z);
 
-    N = grid1.cell(x,y,z).size();
+    N = v.size();
 
     if(N==0) return; // Nothing to do
 
-    const vector<Grid_element>& v = grid1.cell(x,y,z);
+    // Per-thread buffers for kernel output
+    static thread_local vector<int> found;
+    static thread_local vector<float> found_d2;
+    if(int(found.size())<N){
+        found.resize(N);
+        found_d2.resize(N);
+    }
 
     // Absolute or local index is filled during filling the grid before
 
-    if(is_periodic){
-
-        for(i1=0;i1<N-1;++i1){
-            Vector3f* p = v[i1].coor_ptr; // Coord of point in grid1
-            for(i2=i1+1;i2<N;++i2){
-                d = box.distance_squared(*(v[i2].coor_ptr),*p);
-                if(d<=cutoff2){
-                    ind1 = v[i1].index; //index
-                    ind2 = v[i2].index; //index
-                    bon.emplace_back(ind1,ind2);
-                    if(dist_vec) dist_vec->push_back(sqrt(d));
-                }
-            }
+    for(i1=0;i1<N-1;++i1){
+        n = find_within(kernel_prm, false,
+                        v.x[i1], v.y[i1], v.z[i1], // Coord of point in grid1
+                        v, i1+1, found.data(), found_d2.data());
+        ind1 = v.ind[i1]; //index
+        for(k=0;k<n;++k){
+            bon.emplace_back(ind1,v.ind[found[k]]);
+            if(dist_vec) dist_vec->push_back(sqrt(found_d2[k]));
         }
-
-    } else {
-
-        for(i1=0;i1<N-1;++i1){
-            Vector3f* p = v[i1].coor_ptr; // Coord of point in grid1
-            for(i2=i1+1;i2<N;++i2){
-                d = (*(v[i2].coor_ptr)-*p).squaredNorm();
-                if(d<=cutoff2){
-                    ind1 = v[i1].index; //index
-                    ind2 = v[i2].index; //index
-                    bon.emplace_back(ind1,ind2);
-                    if(dist_vec) dist_vec->push_back(sqrt(d));
-                }
-            }
-        }
-
     }
 }
 
@@ -45,14 +45,13 @@ public:
 protected:
     void create_grid(const Selection &sel);
 
-    void do_part(int dim, int _b, int _e,
-                 std::deque<Eigen::Vector2i>& bon,
-                 std::deque<float>* dist_vec) override;
+    void do_cell(int i, int j, int k,
+                 std::vector<Eigen::Vector2i>& bon,
+                 std::vector<float>* dist_vec) override;
 
     void search_in_cell(int x, int y, int z,
-                        std::deque<Eigen::Vector2i> &bon,
-                        std::deque<float> *dist_vec,
-                        bool is_periodic);
+                        std::vector<Eigen::Vector2i> &bon,
+                        std::vector<float> *dist_vec);
 };
 
 }
@@ -31,7 +31,6 @@
 #include "distance_search_contacts_2sel.h"
 #include "search_utils.h"
 #include "pteros/core/pteros_error.h"
-#include <thread>
 
 using namespace std;
 using namespace pteros;
@@ -99,84 +98,41 @@ void Distance_search_contacts_2sel::create_grids(const Selection &sel1, const Se
     // Allocate both grids
     grid1.resize(NgridX,NgridY,NgridZ);
     grid2.resize(NgridX,NgridY,NgridZ);
-    // Allocate visited array
-    visited.resize( boost::extents[NgridX][NgridY][NgridZ] );
 }
 
-void Distance_search_contacts_2sel::do_part(int dim, int _b, int _e, std::deque<Vector2i> &bon, std::deque<float> *dist_vec)
+void Distance_search_contacts_2sel::do_cell(int i, int j, int k, std::vector<Vector2i> &bon, std::vector<float> *dist_vec)
 {
-    Vector3i b(0,0,0);
-    Vector3i e(NgridX,NgridY,NgridZ);
-    int dim_max = e(dim);
-    b(dim)= _b;
-    e(dim)= _e;
-    int i,j,k,i1,nlist_size;
-    Nlist_t nlist; // Local nlist
-
+    static thread_local Nlist_t nlist; // Local nlist
+    int i1, nlist_size;
     int s1,s2,s3;
 
-    for(i=b(0);i<e(0);++i){
-        for(j=b(1);j<e(1);++j){
-            for(k=b(2);k<e(2);++k){
-                // Search in central cell
-                // Central cell is always non-periodic
-                search_in_pair_of_cells(i,j,k, i,j,k,
-                                        grid1,grid2,
-                                        bon,dist_vec,
-                                        false);
-                visited[i][j][k] = true;
-                // Get neighbour list locally
-                get_nlist(i,j,k,nlist);
-                nlist_size = nlist.data.size();
-                // Search between this and neighbouring cells
-                for(i1=0;i1<nlist_size;++i1){
-                    const Vector3i& cell = nlist.data[i1];
-
-                    // If the neighbour is "at left" from the boundary of this part,
-                    // ignore it. Only consider dim dimension.
-                    if(cell(dim)<b(dim)){
-                        continue;
-                    }
-
-                    s1 = cell(0);
-                    s2 = cell(1);
-                    s3 = cell(2);
-
-                    // We only check for visited cells inside local part, not in the "halo"
-                    if(    cell(dim)>=b(dim)
-                        && cell(dim)<e(dim) ){
-                        // cell is inside the local partition
-                        if( !visited[s1][s2][s3] ){
-                            search_in_pair_of_cells(i,j,k,
-                                                    s1,s2,s3,
-                                                    grid1, grid2,
-                                                    bon,dist_vec,
-                                                    nlist.wrapped[i1] && is_periodic);
-                            search_in_pair_of_cells(s1,s2,s3,
-                                                    i,j,k,
-                                                    grid1, grid2,
-                                                    bon,dist_vec,
-                                                    nlist.wrapped[i1] && is_periodic);
-                        }
-                    } else {
-                        // cell is in halo
-                        search_in_pair_of_cells(i,j,k,
-                                                s1,s2,s3,
-                                                grid1, grid2,
-                                                bon,dist_vec,
-                                                nlist.wrapped[i1] && is_periodic);
-                        search_in_pair_of_cells(s1,s2,s3,
-                                                i,j,k,
-                                                grid1, grid2,
-                                                bon,dist_vec,
-                                                nlist.wrapped[i1] && is_periodic);
-                    }
-
-
-                }
-
-            }
-        }
+    // Search in central cell
+    // Central cell is always non-periodic
+    search_in_pair_of_cells(i,j,k, i,j,k,
+                            grid1,grid2,
+                            bon,dist_vec,
+                            Vector3f::Zero());
+    // Get half of neighbour list locally
+    get_nlist(i,j,k,nlist,true);
+    nlist_size = nlist.data.size();
+    // Search between this and neighbouring cells in both directions
+    for(i1=0;i1<nlist_size;++i1){
+        const Vector3i& cell = nlist.data[i1];
+        s1 = cell(0);
+        s2 = cell(1);
+        s3 = cell(2);
+
+        search_in_pair_of_cells(i,j,k,
+                                s1,s2,s3,
+                                grid1, grid2,
+                                bon,dist_vec,
+                                nlist.shift[i1]);
+        // In reverse direction the image is shifted to opposite side
+        search_in_pair_of_cells(s1,s2,s3,
+                                i,j,k,
+                                grid1, grid2,
+                                bon,dist_vec,
+                                -nlist.shift[i1]);
     }
 }
 
@@ -45,9 +45,9 @@ public:
 protected:
     void create_grids(const Selection &sel1, const Selection &sel2);
 
-    void do_part(int dim, int _b, int _e,
-                 std::deque<Eigen::Vector2i>& bon,
-                 std::deque<float>* dist_vec) override;
+    void do_cell(int i, int j, int k,
+                 std::vector<Eigen::Vector2i>& bon,
+                 std::vector<float>* dist_vec) override;
 };
 
 }
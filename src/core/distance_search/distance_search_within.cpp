@@ -31,7 +31,8 @@
 #include "pteros/core/distance_search_within.h"
 #include "pteros/core/pteros_error.h"
 #include "distance_search_within_base.h"
-#include <thread>
+#include "pteros/core/thread_pool.h"
+#include <algorithm>
 
 using namespace std;
 using namespace pteros;
@@ -154,6 +155,105 @@ public:
         used_to_result(res,include_self,*src_ptr,target);
     }
 
+
+    /// Number of source atoms within given distance from each atom of target
+    void count_within(const Selection& target,
+                      std::vector<int>& counts,
+                      bool include_self)
+    {
+        counts.resize(target.size());
+        for_each_target(target, [&](int i, const int* found, const float* d2, int n){
+            int c = n;
+            if(!include_self){
+                for(int k=0;k<n;++k)
+                    if(src_ptr->index(found[k])==target.index(i)) --c;
+            }
+            counts[i] = c;
+        });
+    }
+
+    /// k nearest source atoms within given distance from each atom of target
+    void search_knn(const Selection& target, int k,
+                    std::vector<int>& res,
+                    std::vector<float>* dist_vec,
+                    bool include_self)
+    {
+        if(k<=0) throw Pteros_error("Number of nearest neighbours should be positive!");
+
+        res.assign(target.size()*k,-1);
+        if(dist_vec) dist_vec->assign(target.size()*k,-1.0);
+
+        for_each_target(target, [&](int i, const int* found, const float* d2, int n){
+            // Max-heap of size k on squared distance
+            static thread_local vector<pair<float,int>> heap;
+            heap.clear();
+            for(int j=0;j<n;++j){
+                if(!include_self && src_ptr->index(found[j])==target.index(i)) continue;
+                if(int(heap.size())<k){
+                    heap.emplace_back(d2[j],found[j]);
+                    push_heap(heap.begin(),heap.end());
+                } else if(d2[j]<heap.front().first){
+                    pop_heap(heap.begin(),heap.end());
+                    heap.back() = {d2[j],found[j]};
+                    push_heap(heap.begin(),heap.end());
+                }
+            }
+            // Gives ascending order of distances
+            sort_heap(heap.begin(),heap.end());
+            for(int j=0;j<int(heap.size());++j){
+                res[i*k+j] = abs_index ? src_ptr->index(heap[j].second) : heap[j].second;
+                if(dist_vec) (*dist_vec)[i*k+j] = sqrt(heap[j].first);
+            }
+        });
+    }
+
+private:
+    // Calls body(i,found,d2,n) for each atom i of target with local indexes
+    // and squared distances of all source atoms within cutoff.
+    // Atoms of target are processed in parallel.
+    template<class F>
+    void for_each_target(const Selection& target, F body){
+        if(!src_ptr) throw Pteros_error("Distance search is not set up!");
+
+        kernel_prm.setup(cutoff,box,false);
+        set_image_shifts();
+
+        auto& pool = Thread_pool::instance();
+        int chunk = std::max(16, target.size()/(8*pool.get_num_threads())+1);
+
+        pool.parallel_for(target.size(), chunk, [&](int b, int e, int th){
+            Nlist_t nlist;
+            vector<int> found;
+            vector<float> found_d2;
+            Vector3i cell;
+            Vector3f p;
+
+            for(int i=b;i<e;++i){
+                int n = 0;
+                if(locate_point(target.xyz(i),cell,p)){
+                    get_nlist(cell(0),cell(1),cell(2),nlist);
+                    nlist.append(cell);
+                    for(int c=0;c<int(nlist.data.size());++c){
+                        const Vector3i& nc = nlist.data[c];
+                        const Grid_cell v = grid1.cell(nc(0),nc(1),nc(2));
+                        if(int(found.size())<n+v.size()){
+                            found.resize(n+v.size());
+                            found_d2.resize(n+v.size());
+                        }
+                        const Vector3f& sh = nlist.shift[c];
+                        int m = find_within(kernel_prm, false,
+                                            p(0)-sh(0), p(1)-sh(1), p(2)-sh(2),
+                                            v, 0, found.data()+n, found_d2.data()+n);
+                        // Kernel returns positions in the cell, convert them to indexes
+                        for(int j=n;j<n+m;++j) found[j] = v.ind[found[j]];
+                        n += m;
+                    }
+                }
+                body(i,found.data(),found_d2.data(),n);
+            }
+        });
+    }
+
 };
 
 
@@ -188,4 +288,14 @@ void Distance_search_within::search_within(const Selection &target, std::vector<
     p->search_within(target,res,include_self);
 }
 
+void Distance_search_within::count_within(const Selection &target, std::vector<int> &counts, bool include_self)
+{
+    p->count_within(target,counts,include_self);
+}
+
+void Distance_search_within::search_knn(const Selection &target, int k, std::vector<int> &res, std::vector<float> *dist_vec, bool include_self)
+{
+    p->search_knn(target,k,res,dist_vec,include_self);
+}
+
 
@@ -29,7 +29,7 @@
 
 
 #include "distance_search_within_base.h"
-#include <thread>
+#include "pteros/core/thread_pool.h"
 
 using namespace std;
 using namespace pteros;
@@ -38,167 +38,121 @@ using namespace Eigen;
 void Distance_search_within_base::used_to_result(vector<int>& res, bool include_self,
                                                  const Selection& src,
                                                  const Selection& target){
-    res.clear();
     // Convert used to result
     if(include_self){
-        if(abs_index){
-            for(int i=0;i<used.size();++i)
-                if(used[i].load()) res.push_back(src.index(i));
-        } else {
-            for(int i=0;i<used.size();++i)
-                if(used[i].load()) res.push_back(i);
-        }
+        used_to_indexes(res,src);
     } else {
         vector<int> dum;
+        used_to_indexes(dum,src);
 
-        if(abs_index){
-            for(int i=0;i<used.size();++i)
-                if(used[i].load()) dum.push_back(src.index(i));
-        } else {
-            for(int i=0;i<used.size();++i)
-                if(used[i].load()) dum.push_back(i);
-        }
-
+        res.clear();
         set_difference(dum.begin(),dum.end(),
                        target.index_begin(),target.index_end(),
                        back_inserter(res));
     }
 }
 
+void Distance_search_within_base::used_to_indexes(vector<int>& res, const Selection& src){
+    auto& pool = Thread_pool::instance();
+    int Nwords = used.num_words();
+    // Words are processed in blocks. Number of set bits in each block is
+    // counted first, then each block is written at its offset.
+    int chunk = std::max(256, Nwords/(4*pool.get_num_threads())+1);
+    int Nchunks = (Nwords+chunk-1)/chunk;
+    vector<int> offset(Nchunks+1,0);
+
+    pool.parallel_for(Nwords, chunk, [&](int b, int e, int th){
+        int n = 0;
+        for(int w=b;w<e;++w) n += __builtin_popcountll(used.word(w));
+        offset[b/chunk+1] = n;
+    });
+
+    for(int i=0;i<Nchunks;++i) offset[i+1] += offset[i];
+    res.resize(offset[Nchunks]);
+
+    pool.parallel_for(Nwords, chunk, [&](int b, int e, int th){
+        int pos = offset[b/chunk];
+        for(int w=b;w<e;++w){
+            uint64_t bits = used.word(w);
+            while(bits){
+                int i = w*64 + __builtin_ctzll(bits);
+                res[pos++] = abs_index ? src.index(i) : i;
+                bits &= bits-1;
+            }
+        }
+    });
+}
+
 void Distance_search_within_base::do_search(int sel_size)
 {
+    // Periodicity is handled by the image shifts of neighbour cells,
+    // so kernels never apply minimum image
+    kernel_prm.setup(cutoff,box,false);
+    set_image_shifts();
+
     used.resize(sel_size);
-    for(int i=0;i<used.size();++i) used[i].store(false);
 
     //------------
     // Search part
     //------------
 
-    // See if we need parallelization
-    int max_N, max_dim;
-    Vector3i dims(NgridX,NgridY,NgridZ);
-    max_N = dims.maxCoeff(&max_dim);
-
-    int nt = std::min(max_N, int(std::thread::hardware_concurrency()));
-
-    if(nt>1){
-        // Parallel search
-
-        // Determine parts for each thread
-        vector<int> b(nt),e(nt);
-        int cur=0;
-        for(int i=0;i<nt-1;++i){
-            b[i]=cur;
-            cur += dims(max_dim)/nt;
-            e[i]=cur;
-        }
-        b[nt-1]=cur;
-        e[nt-1]=dims(max_dim);
-
-        // Launch threads
-        vector<thread> threads;
-        for(int i=0;i<nt;++i){
-            threads.emplace_back(
-                                   std::bind(
-                                       &Distance_search_within_base::do_part,
-                                       this,
-                                       max_dim,
-                                       b[i],
-                                       e[i]
-                                   )                                
-                             );
+    // Cells are distributed between the threads dynamically
+    auto& pool = Thread_pool::instance();
+    int Ncells = NgridX*NgridY*NgridZ;
+    int chunk = std::max(1, Ncells/(8*pool.get_num_threads()));
+
+    pool.parallel_for(Ncells, chunk, [this](int b, int e, int th){
+        for(int c=b;c<e;++c){
+            int i = c/(NgridY*NgridZ);
+            int j = (c/NgridZ)%NgridY;
+            int k = c%NgridZ;
+            do_cell(i,j,k);
         }
-
-        // Wait for threads
-        for(auto& t: threads) t.join();
-
-    } else {
-        // Serial search, no need to launch separate thread
-        do_part(max_dim,0,dims(max_dim));
-    }
-
+    });
 }
 
 
-void Distance_search_within_base::do_part(int dim, int _b, int _e){
-    Vector3i b(0,0,0);
-    Vector3i e(NgridX,NgridY,NgridZ);
-    int dim_max = e(dim);
-    b(dim)= _b;
-    e(dim)= _e;
-
-    int i,j,k,c,t,ind;
-    Nlist_t nlist; // Local nlist
-    nlist.data.reserve(27);
-    nlist.wrapped.reserve(27);
-
-    for(i=b(0);i<e(0);++i){
-        for(j=b(1);j<e(1);++j){
-            for(k=b(2);k<e(2);++k){
+void Distance_search_within_base::do_cell(int i, int j, int k){
+    static thread_local Nlist_t nlist; // Local nlist
 
-                // Search in central cell
-                search_in_pair_of_cells(i,j,k, //src cell
-                                        i,j,k, //target cell
-                                        false);
-                // Get nlist
-                get_nlist(i,j,k,nlist);
+    // Search in central cell
+    search_in_pair_of_cells(i,j,k, //src cell
+                            i,j,k, //target cell
+                            Vector3f::Zero());
+    // Get nlist
+    get_nlist(i,j,k,nlist);
 
-                // Cycle over nlist
-                for(c=0;c<nlist.data.size();++c){
-                    const Vector3i& cell = nlist.data[c];
+    // Cycle over nlist
+    for(int c=0;c<int(nlist.data.size());++c){
+        const Vector3i& cell = nlist.data[c];
 
-                    search_in_pair_of_cells(i,j,k, //src cell
-                                            cell(0),cell(1),cell(2), //target cell
-                                            nlist.wrapped[c] && is_periodic);
-                }
-
-            }
-        }
+        search_in_pair_of_cells(i,j,k, //src cell
+                                cell(0),cell(1),cell(2), //target cell
+                                nlist.shift[c]);
     }
-
 }
 
 void Distance_search_within_base::search_in_pair_of_cells(int sx, int sy, int sz, // src cell
                              int tx, int ty, int tz, // target cell
-                             bool is_periodic)
+                             Vector3f_const_ref shift)
 {
-    int Ns,Nt,ind,s,t;
-    float d;
-    float cutoff2 = cutoff*cutoff;
+    int Ns,Nt,ind,s;
 
-    Ns = grid1.cell(sx,sy,sz).size(); //src
-    Nt = grid2.cell(tx,ty,tz).size(); //target
+    const Grid_cell sv = grid1.cell(sx,sy,sz); //src
+    const Grid_cell tv = grid2.cell(tx,ty,tz); //target
 
-    if(Ns*Nt==0) return; // Nothing to do
+    Ns = sv.size();
+    Nt = tv.size();
 
-    const vector<Grid_element>& sv = grid1.cell(sx,sy,sz);
-    const vector<Grid_element>& tv = grid2.cell(tx,ty,tz);
+    if(Ns*Nt==0) return; // Nothing to do
 
     for(s=0;s<Ns;++s){
-        ind = sv[s].index; // Local index here
+        ind = sv.ind[s]; // Local index here
         // Skip already used source points
-        if(used[ind].load()) continue;
-
-        Vector3f* p = sv[s].coor_ptr; // Coord of source point
-
-        if(is_periodic){
-            for(t=0;t<Nt;++t){
-                d = box.distance_squared(*(tv[t].coor_ptr),*p);
-                if(d<=cutoff2){
-                    used[ind].store(true);
-                    break;
-                }
-            }
-        } else {
-            for(t=0;t<Nt;++t){
-                d = (*(tv[t].coor_ptr)-*p).squaredNorm();
-                if(d<=cutoff2){
-                    used[ind].store(true);
-                    break;
-                }
-            }
-        }
+        if(used.test(ind)) continue;
 
+        if(any_within(kernel_prm, false, sv.x[s]-shift(0), sv.y[s]-shift(1), sv.z[s]-shift(2), tv, 0))
+            used.set(ind);
     }
 }
 
@@ -32,21 +32,24 @@
 #define DISTANCE_SEARCH_WITHIN_BASE_H_INCLUDED
 
 #include "distance_search_base.h"
-#include "atomic_wrapper.h"
+#include "atomic_bitset.h"
 
 namespace pteros {       
 
 class Distance_search_within_base: public Distance_search_base {
 protected:
-    // Array of atomic bools for used source points
-    std::vector<atomic_wrapper<bool>> used;
+    // Bits for used source points
+    Atomic_bitset used;
     void do_search(int sel_size);
-    void do_part(int dim, int _b, int _e);
+    // Search around single cell
+    void do_cell(int i, int j, int k);
     // Pointer to source selection
     Selection* src_ptr;
-    void search_in_pair_of_cells(int sx, int sy, int sz, int tx, int ty, int tz, bool is_periodic);
+    void search_in_pair_of_cells(int sx, int sy, int sz, int tx, int ty, int tz, Vector3f_const_ref shift);
     void used_to_result(std::vector<int>& res, bool include_self,
                         const Selection &src, const Selection &target);
+    // Collects indexes of set bits of used in parallel
+    void used_to_indexes(std::vector<int>& res, const Selection &src);
 };
 
 }
@@ -32,7 +32,7 @@
 #define DISTANCE_SEARCH_WITHIN_SEL_H_INCLUDED
 
 #include "distance_search_within_base.h"
-#include "atomic_wrapper.h"
+#include "atomic_bitset.h"
 
 namespace pteros {       
 
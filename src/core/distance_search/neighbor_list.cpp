@@ -0,0 +1,260 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+
+#include "pteros/core/neighbor_list.h"
+#include "pteros/core/distance_search.h"
+#include "pteros/core/pteros_error.h"
+#include <algorithm>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+
+class Neighbor_list::Neighbor_list_impl {
+public:
+    Neighbor_list_impl(): n_builds(0), sel1_ptr(nullptr), sel2_ptr(nullptr), built(false) {}
+
+    void setup(float d, const Selection* sel1, const Selection* sel2,
+               float sk, bool absolute_index, bool periodic)
+    {
+        if(sk<0) throw Pteros_error("Skin of neighbour list can't be negative!");
+        cutoff = d;
+        skin = sk;
+        abs_index = absolute_index;
+        is_periodic = periodic;
+        sel1_ptr = sel1;
+        sel2_ptr = sel2;
+        invalidate();
+    }
+
+    void invalidate(){
+        built = false;
+        candidates.clear();
+        images.clear();
+        ind1.clear();
+        ind2.clear();
+        ref1.clear();
+        ref2.clear();
+    }
+
+    void search_contacts(vector<Vector2i>& pairs, vector<float>* dist_vec){
+        if(!sel1_ptr) throw Pteros_error("Neighbour list is not set up!");
+
+        if(need_rebuild()) build();
+
+        const Selection& s1 = *sel1_ptr;
+        const Selection& s2 = sel2_ptr ? *sel2_ptr : *sel1_ptr;
+
+        pairs.clear();
+        if(dist_vec) dist_vec->clear();
+
+        // Filter candidates by actual distances. In periodic case the image
+        // found at build time is used with current box vectors, so the result
+        // agrees with the exact image shifts of the grid search even in
+        // strongly skewed triclinic boxes.
+        float cutoff2 = cutoff*cutoff;
+        Matrix3f m = s1.box().get_matrix();
+        float d2;
+        for(int i=0;i<int(candidates.size());++i){
+            const Vector2i& c = candidates[i];
+            if(is_periodic)
+                d2 = (s2.xyz(c(1))-s1.xyz(c(0))+m*images[i]).squaredNorm();
+            else
+                d2 = (s2.xyz(c(1))-s1.xyz(c(0))).squaredNorm();
+            if(d2<=cutoff2){
+                if(abs_index)
+                    pairs.emplace_back(s1.index(c(0)),s2.index(c(1)));
+                else
+                    pairs.push_back(c);
+                if(dist_vec) dist_vec->push_back(sqrt(d2));
+            }
+        }
+    }
+
+    int n_builds;
+
+private:
+    const Selection* sel1_ptr;
+    const Selection* sel2_ptr;
+    float cutoff, skin;
+    bool abs_index, is_periodic;
+    // Candidate pairs within cutoff+skin (local indexes)
+    vector<Vector2i> candidates;
+    // Periodic image of the second atom of each candidate pair in box vectors
+    vector<Vector3f> images;
+    // Indexes and coordinates of selections at the moment of last build
+    vector<int> ind1, ind2;
+    vector<Vector3f> ref1, ref2;
+    Matrix3f ref_box;
+    bool built;
+
+    static bool same_index(const Selection& sel, const vector<int>& ind){
+        return sel.size()==int(ind.size()) && equal(ind.begin(),ind.end(),sel.index_begin());
+    }
+
+    static float max_displacement2(const Selection& sel, const vector<Vector3f>& ref){
+        float m = 0.0, d;
+        for(int i=0;i<sel.size();++i){
+            d = (sel.xyz(i)-ref[i]).squaredNorm();
+            if(d>m) m = d;
+        }
+        return m;
+    }
+
+    bool need_rebuild(){
+        if(!built) return true;
+
+        // Selections changed
+        if(!same_index(*sel1_ptr,ind1)) return true;
+        if(sel2_ptr && !same_index(*sel2_ptr,ind2)) return true;
+
+        // Max displacement since last build
+        float m = max_displacement2(*sel1_ptr,ref1);
+        if(sel2_ptr) m = std::max(m,max_displacement2(*sel2_ptr,ref2));
+        float drift = 2.0*sqrt(m);
+
+        // Change of the box shifts periodic images
+        if(is_periodic){
+            Matrix3f b = sel1_ptr->box().get_matrix();
+            drift += (b-ref_box).colwise().norm().sum();
+        }
+
+        return drift > skin;
+    }
+
+    static void save_state(const Selection& sel, vector<int>& ind, vector<Vector3f>& ref){
+        ind.assign(sel.index_begin(),sel.index_end());
+        ref.resize(sel.size());
+        for(int i=0;i<sel.size();++i) ref[i] = sel.xyz(i);
+    }
+
+    // Find the closest periodic image for each candidate pair. Rounding of
+    // fractional coordinates gives the closest image if it is closer than
+    // half of the smallest box height. Otherwise all neighbouring images
+    // are checked, since in skewed triclinic boxes rounding may pick wrong one.
+    void find_images(){
+        const Selection& s1 = *sel1_ptr;
+        const Selection& s2 = sel2_ptr ? *sel2_ptr : *sel1_ptr;
+        Matrix3f m = s1.box().get_matrix();
+        Matrix3f m_inv = s1.box().get_inv_matrix();
+
+        float V = std::abs(m.col(0).dot(m.col(1).cross(m.col(2))));
+        float h = V/std::max({m.col(1).cross(m.col(2)).norm(),
+                              m.col(2).cross(m.col(0)).norm(),
+                              m.col(0).cross(m.col(1)).norm()});
+        float safe2 = 0.25*h*h;
+
+        Vector3f d, n0, n;
+        float d2, best;
+
+        images.resize(candidates.size());
+        for(int i=0;i<int(candidates.size());++i){
+            d = s2.xyz(candidates[i](1))-s1.xyz(candidates[i](0));
+            n0 = -(m_inv*d).array().round();
+            images[i] = n0;
+            best = (d+m*n0).squaredNorm();
+            if(best<=safe2) continue;
+
+            for(int n1=-1;n1<=1;++n1)
+                for(int n2=-1;n2<=1;++n2)
+                    for(int n3=-1;n3<=1;++n3){
+                        n = n0+Vector3f(n1,n2,n3);
+                        d2 = (d+m*n).squaredNorm();
+                        if(d2<best){
+                            best = d2;
+                            images[i] = n;
+                        }
+                    }
+        }
+    }
+
+    void build(){
+        if(sel2_ptr){
+            pteros::search_contacts(cutoff+skin,*sel1_ptr,*sel2_ptr,candidates,false,is_periodic);
+            save_state(*sel2_ptr,ind2,ref2);
+        } else {
+            pteros::search_contacts(cutoff+skin,*sel1_ptr,candidates,false,is_periodic);
+        }
+        save_state(*sel1_ptr,ind1,ref1);
+        ref_box = sel1_ptr->box().get_matrix();
+        if(is_periodic) find_images();
+        built = true;
+        ++n_builds;
+    }
+};
+
+
+Neighbor_list::Neighbor_list()
+{
+    p = unique_ptr<Neighbor_list_impl>(new Neighbor_list_impl());
+}
+
+Neighbor_list::Neighbor_list(float d, const Selection &sel, float skin, bool absolute_index, bool periodic)
+{
+    p = unique_ptr<Neighbor_list_impl>(new Neighbor_list_impl());
+    p->setup(d,&sel,nullptr,skin,absolute_index,periodic);
+}
+
+Neighbor_list::Neighbor_list(float d, const Selection &sel1, const Selection &sel2, float skin, bool absolute_index, bool periodic)
+{
+    p = unique_ptr<Neighbor_list_impl>(new Neighbor_list_impl());
+    p->setup(d,&sel1,&sel2,skin,absolute_index,periodic);
+}
+
+Neighbor_list::~Neighbor_list()
+{
+
+}
+
+void Neighbor_list::setup(float d, const Selection &sel, float skin, bool absolute_index, bool periodic)
+{
+    p->setup(d,&sel,nullptr,skin,absolute_index,periodic);
+}
+
+void Neighbor_list::setup(float d, const Selection &sel1, const Selection &sel2, float skin, bool absolute_index, bool periodic)
+{
+    p->setup(d,&sel1,&sel2,skin,absolute_index,periodic);
+}
+
+void Neighbor_list::search_contacts(std::vector<Vector2i> &pairs, std::vector<float> *dist_vec)
+{
+    p->search_contacts(pairs,dist_vec);
+}
+
+void Neighbor_list::invalidate()
+{
+    p->invalidate();
+}
+
+int Neighbor_list::num_builds() const
+{
+    return p->n_builds;
+}
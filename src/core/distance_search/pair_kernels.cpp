@@ -0,0 +1,371 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+
+#include "pair_kernels.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PTEROS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+void Pair_kernel_params::setup(float cutoff, const Periodic_box &b, bool periodic)
+{
+    cutoff2 = cutoff*cutoff;
+    if(periodic && b.is_periodic()){
+        pbc_mode = b.is_triclinic() ? 2 : 1;
+        Matrix3f m = b.get_matrix();
+        Matrix3f m_inv = b.get_inv_matrix();
+        for(int i=0;i<9;++i){
+            box[i] = m.data()[i];
+            box_inv[i] = m_inv.data()[i];
+        }
+    } else {
+        pbc_mode = 0;
+    }
+}
+
+namespace {
+
+using find_func_t = int (*)(const Pair_kernel_params&, float, float, float,
+                            const float*, const float*, const float*, int, int, int*, float*);
+using any_func_t = bool (*)(const Pair_kernel_params&, float, float, float,
+                            const float*, const float*, const float*, int, int);
+
+// Set of kernels for each pbc mode
+struct Kernel_set {
+    find_func_t find[3];
+    any_func_t any[3];
+    const char* isa;
+};
+
+//----------------------------------
+// Scalar kernels
+//----------------------------------
+
+// Minimum image of d=p2-p1 for given pbc mode. Box matrices are column-major.
+template<int MODE>
+inline void min_image_scalar(const Pair_kernel_params& prm, float& dx, float& dy, float& dz){
+    if(MODE==1){
+        dx -= prm.box[0]*nearbyintf(dx*prm.box_inv[0]);
+        dy -= prm.box[4]*nearbyintf(dy*prm.box_inv[4]);
+        dz -= prm.box[8]*nearbyintf(dz*prm.box_inv[8]);
+    } else if(MODE==2){
+        const float* m = prm.box_inv;
+        float fx = m[0]*dx + m[3]*dy + m[6]*dz;
+        float fy = m[1]*dx + m[4]*dy + m[7]*dz;
+        float fz = m[2]*dx + m[5]*dy + m[8]*dz;
+        fx -= nearbyintf(fx);
+        fy -= nearbyintf(fy);
+        fz -= nearbyintf(fz);
+        m = prm.box;
+        dx = m[0]*fx + m[3]*fy + m[6]*fz;
+        dy = m[1]*fx + m[4]*fy + m[7]*fz;
+        dz = m[2]*fx + m[5]*fy + m[8]*fz;
+    }
+}
+
+template<int MODE>
+int find_scalar(const Pair_kernel_params& prm, float px, float py, float pz,
+                const float* x, const float* y, const float* z, int b, int e,
+                int* out_j, float* out_d2)
+{
+    int n = 0;
+    for(int j=b;j<e;++j){
+        float dx = x[j]-px;
+        float dy = y[j]-py;
+        float dz = z[j]-pz;
+        min_image_scalar<MODE>(prm,dx,dy,dz);
+        float d2 = dx*dx+dy*dy+dz*dz;
+        if(d2<=prm.cutoff2){
+            out_j[n] = j;
+            out_d2[n] = d2;
+            ++n;
+        }
+    }
+    return n;
+}
+
+template<int MODE>
+bool any_scalar(const Pair_kernel_params& prm, float px, float py, float pz,
+                const float* x, const float* y, const float* z, int b, int e)
+{
+    for(int j=b;j<e;++j){
+        float dx = x[j]-px;
+        float dy = y[j]-py;
+        float dz = z[j]-pz;
+        min_image_scalar<MODE>(prm,dx,dy,dz);
+        if(dx*dx+dy*dy+dz*dz<=prm.cutoff2) return true;
+    }
+    return false;
+}
+
+#ifdef PTEROS_X86_KERNELS
+
+//----------------------------------
+// AVX2 kernels (8 target atoms at once)
+//----------------------------------
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+template<int MODE>
+AVX2_TARGET inline __m256 squared_dist_avx2(const Pair_kernel_params& prm,
+                                            __m256 dx, __m256 dy, __m256 dz)
+{
+    const int rnd = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+    if(MODE==1){
+        dx = _mm256_sub_ps(dx, _mm256_mul_ps(_mm256_set1_ps(prm.box[0]),
+                 _mm256_round_ps(_mm256_mul_ps(dx,_mm256_set1_ps(prm.box_inv[0])),rnd)));
+        dy = _mm256_sub_ps(dy, _mm256_mul_ps(_mm256_set1_ps(prm.box[4]),
+                 _mm256_round_ps(_mm256_mul_ps(dy,_mm256_set1_ps(prm.box_inv[4])),rnd)));
+        dz = _mm256_sub_ps(dz, _mm256_mul_ps(_mm256_set1_ps(prm.box[8]),
+                 _mm256_round_ps(_mm256_mul_ps(dz,_mm256_set1_ps(prm.box_inv[8])),rnd)));
+    } else if(MODE==2){
+        __m256 m[9];
+        for(int i=0;i<9;++i) m[i] = _mm256_set1_ps(prm.box_inv[i]);
+        __m256 fx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0],dx),_mm256_mul_ps(m[3],dy)),_mm256_mul_ps(m[6],dz));
+        __m256 fy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[1],dx),_mm256_mul_ps(m[4],dy)),_mm256_mul_ps(m[7],dz));
+        __m256 fz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[2],dx),_mm256_mul_ps(m[5],dy)),_mm256_mul_ps(m[8],dz));
+        fx = _mm256_sub_ps(fx,_mm256_round_ps(fx,rnd));
+        fy = _mm256_sub_ps(fy,_mm256_round_ps(fy,rnd));
+        fz = _mm256_sub_ps(fz,_mm256_round_ps(fz,rnd));
+        for(int i=0;i<9;++i) m[i] = _mm256_set1_ps(prm.box[i]);
+        dx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0],fx),_mm256_mul_ps(m[3],fy)),_mm256_mul_ps(m[6],fz));
+        dy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[1],fx),_mm256_mul_ps(m[4],fy)),_mm256_mul_ps(m[7],fz));
+        dz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[2],fx),_mm256_mul_ps(m[5],fy)),_mm256_mul_ps(m[8],fz));
+    }
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx,dx),_mm256_mul_ps(dy,dy)),_mm256_mul_ps(dz,dz));
+}
+
+template<int MODE>
+AVX2_TARGET int find_avx2(const Pair_kernel_params& prm, float px, float py, float pz,
+                          const float* x, const float* y, const float* z, int b, int e,
+                          int* out_j, float* out_d2)
+{
+    __m256 vpx = _mm256_set1_ps(px);
+    __m256 vpy = _mm256_set1_ps(py);
+    __m256 vpz = _mm256_set1_ps(pz);
+    __m256 vc2 = _mm256_set1_ps(prm.cutoff2);
+    alignas(32) float d2buf[8];
+    int n = 0;
+    int j = b;
+    for(;j+8<=e;j+=8){
+        __m256 d2 = squared_dist_avx2<MODE>(prm,
+                                         _mm256_sub_ps(_mm256_loadu_ps(x+j),vpx),
+                                         _mm256_sub_ps(_mm256_loadu_ps(y+j),vpy),
+                                         _mm256_sub_ps(_mm256_loadu_ps(z+j),vpz));
+        unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(d2,vc2,_CMP_LE_OQ));
+        if(!mask) continue;
+        _mm256_store_ps(d2buf,d2);
+        // Compress found atoms into output
+        while(mask){
+            int k = __builtin_ctz(mask);
+            out_j[n] = j+k;
+            out_d2[n] = d2buf[k];
+            ++n;
+            mask &= mask-1;
+        }
+    }
+    // Remainder
+    return n + find_scalar<MODE>(prm,px,py,pz,x,y,z,j,e,out_j+n,out_d2+n);
+}
+
+template<int MODE>
+AVX2_TARGET bool any_avx2(const Pair_kernel_params& prm, float px, float py, float pz,
+                          const float* x, const float* y, const float* z, int b, int e)
+{
+    __m256 vpx = _mm256_set1_ps(px);
+    __m256 vpy = _mm256_set1_ps(py);
+    __m256 vpz = _mm256_set1_ps(pz);
+    __m256 vc2 = _mm256_set1_ps(prm.cutoff2);
+    int j = b;
+    for(;j+8<=e;j+=8){
+        __m256 d2 = squared_dist_avx2<MODE>(prm,
+                                         _mm256_sub_ps(_mm256_loadu_ps(x+j),vpx),
+                                         _mm256_sub_ps(_mm256_loadu_ps(y+j),vpy),
+                                         _mm256_sub_ps(_mm256_loadu_ps(z+j),vpz));
+        if(_mm256_movemask_ps(_mm256_cmp_ps(d2,vc2,_CMP_LE_OQ))) return true;
+    }
+    return any_scalar<MODE>(prm,px,py,pz,x,y,z,j,e);
+}
+
+//----------------------------------
+// AVX-512 kernels (16 target atoms at once)
+//----------------------------------
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+template<int MODE>
+AVX512_TARGET inline __m512 squared_dist_avx512(const Pair_kernel_params& prm,
+                                                __m512 dx, __m512 dy, __m512 dz)
+{
+    const int rnd = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+    if(MODE==1){
+        dx = _mm512_sub_ps(dx, _mm512_mul_ps(_mm512_set1_ps(prm.box[0]),
+                 _mm512_roundscale_ps(_mm512_mul_ps(dx,_mm512_set1_ps(prm.box_inv[0])),rnd)));
+        dy = _mm512_sub_ps(dy, _mm512_mul_ps(_mm512_set1_ps(prm.box[4]),
+                 _mm512_roundscale_ps(_mm512_mul_ps(dy,_mm512_set1_ps(prm.box_inv[4])),rnd)));
+        dz = _mm512_sub_ps(dz, _mm512_mul_ps(_mm512_set1_ps(prm.box[8]),
+                 _mm512_roundscale_ps(_mm512_mul_ps(dz,_mm512_set1_ps(prm.box_inv[8])),rnd)));
+    } else if(MODE==2){
+        __m512 m[9];
+        for(int i=0;i<9;++i) m[i] = _mm512_set1_ps(prm.box_inv[i]);
+        __m512 fx = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[0],dx),_mm512_mul_ps(m[3],dy)),_mm512_mul_ps(m[6],dz));
+        __m512 fy = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[1],dx),_mm512_mul_ps(m[4],dy)),_mm512_mul_ps(m[7],dz));
+        __m512 fz = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[2],dx),_mm512_mul_ps(m[5],dy)),_mm512_mul_ps(m[8],dz));
+        fx = _mm512_sub_ps(fx,_mm512_roundscale_ps(fx,rnd));
+        fy = _mm512_sub_ps(fy,_mm512_roundscale_ps(fy,rnd));
+        fz = _mm512_sub_ps(fz,_mm512_roundscale_ps(fz,rnd));
+        for(int i=0;i<9;++i) m[i] = _mm512_set1_ps(prm.box[i]);
+        dx = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[0],fx),_mm512_mul_ps(m[3],fy)),_mm512_mul_ps(m[6],fz));
+        dy = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[1],fx),_mm512_mul_ps(m[4],fy)),_mm512_mul_ps(m[7],fz));
+        dz = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(m[2],fx),_mm512_mul_ps(m[5],fy)),_mm512_mul_ps(m[8],fz));
+    }
+    return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx,dx),_mm512_mul_ps(dy,dy)),_mm512_mul_ps(dz,dz));
+}
+
+template<int MODE>
+AVX512_TARGET int find_avx512(const Pair_kernel_params& prm, float px, float py, float pz,
+                              const float* x, const float* y, const float* z, int b, int e,
+                              int* out_j, float* out_d2)
+{
+    __m512 vpx = _mm512_set1_ps(px);
+    __m512 vpy = _mm512_set1_ps(py);
+    __m512 vpz = _mm512_set1_ps(pz);
+    __m512 vc2 = _mm512_set1_ps(prm.cutoff2);
+    __m512i vj = _mm512_add_epi32(_mm512_set1_epi32(b),
+                                  _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15));
+    __m512i step = _mm512_set1_epi32(16);
+    int n = 0;
+    for(int j=b;j<e;j+=16){
+        // Tail is handled by masked loads
+        __mmask16 valid = (e-j>=16) ? 0xFFFF : __mmask16((1u<<(e-j))-1);
+        __m512 d2 = squared_dist_avx512<MODE>(prm,
+                                   _mm512_sub_ps(_mm512_maskz_loadu_ps(valid,x+j),vpx),
+                                   _mm512_sub_ps(_mm512_maskz_loadu_ps(valid,y+j),vpy),
+                                   _mm512_sub_ps(_mm512_maskz_loadu_ps(valid,z+j),vpz));
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(valid,d2,vc2,_CMP_LE_OQ);
+        // Write compressed results directly to output
+        _mm512_mask_compressstoreu_epi32(out_j+n,mask,vj);
+        _mm512_mask_compressstoreu_ps(out_d2+n,mask,d2);
+        n += __builtin_popcount(mask);
+        vj = _mm512_add_epi32(vj,step);
+    }
+    return n;
+}
+
+template<int MODE>
+AVX512_TARGET bool any_avx512(const Pair_kernel_params& prm, float px, float py, float pz,
+                              const float* x, const float* y, const float* z, int b, int e)
+{
+    __m512 vpx = _mm512_set1_ps(px);
+    __m512 vpy = _mm512_set1_ps(py);
+    __m512 vpz = _mm512_set1_ps(pz);
+    __m512 vc2 = _mm512_set1_ps(prm.cutoff2);
+    for(int j=b;j<e;j+=16){
+        __mmask16 valid = (e-j>=16) ? 0xFFFF : __mmask16((1u<<(e-j))-1);
+        __m512 d2 = squared_dist_avx512<MODE>(prm,
+                                   _mm512_sub_ps(_mm512_maskz_loadu_ps(valid,x+j),vpx),
+                                   _mm512_sub_ps(_mm512_maskz_loadu_ps(valid,y+j),vpy),
+                                   _mm512_sub_ps(_mm512_maskz_loadu_ps(valid,z+j),vpz));
+        if(_mm512_mask_cmp_ps_mask(valid,d2,vc2,_CMP_LE_OQ)) return true;
+    }
+    return false;
+}
+
+#endif
+
+// Choose the best kernels supported by current CPU
+Kernel_set select_kernels(){
+#ifdef PTEROS_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return { {find_avx512<0>,find_avx512<1>,find_avx512<2>},
+                 {any_avx512<0>,any_avx512<1>,any_avx512<2>}, "avx512" };
+    if(__builtin_cpu_supports("avx2"))
+        return { {find_avx2<0>,find_avx2<1>,find_avx2<2>},
+                 {any_avx2<0>,any_avx2<1>,any_avx2<2>}, "avx2" };
+#endif
+    return { {find_scalar<0>,find_scalar<1>,find_scalar<2>},
+             {any_scalar<0>,any_scalar<1>,any_scalar<2>}, "scalar" };
+}
+
+const Kernel_set& kernels(){
+    static const Kernel_set k = select_kernels();
+    return k;
+}
+
+} // namespace
+
+
+namespace pteros {
+
+int find_within(const Pair_kernel_params& prm, bool periodic,
+                float px, float py, float pz,
+                const Grid_cell& t, int b,
+                int* out_j, float* out_d2)
+{
+    int mode = periodic ? prm.pbc_mode : 0;
+    return kernels().find[mode](prm,px,py,pz,t.x,t.y,t.z,b,t.n,out_j,out_d2);
+}
+
+bool any_within(const Pair_kernel_params& prm, bool periodic,
+                float px, float py, float pz,
+                const Grid_cell& t, int b)
+{
+    int mode = periodic ? prm.pbc_mode : 0;
+    return kernels().any[mode](prm,px,py,pz,t.x,t.y,t.z,b,t.n);
+}
+
+float pair_distance_squared(const Pair_kernel_params& prm, bool periodic,
+                            Vector3f_const_ref p1, Vector3f_const_ref p2)
+{
+    float dx = p2(0)-p1(0);
+    float dy = p2(1)-p1(1);
+    float dz = p2(2)-p1(2);
+    if(periodic){
+        if(prm.pbc_mode==1)
+            min_image_scalar<1>(prm,dx,dy,dz);
+        else if(prm.pbc_mode==2)
+            min_image_scalar<2>(prm,dx,dy,dz);
+    }
+    return dx*dx+dy*dy+dz*dz;
+}
+
+const char* pair_kernels_isa()
+{
+    return kernels().isa;
+}
+
+}
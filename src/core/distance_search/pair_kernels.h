@@ -0,0 +1,75 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+
+#ifndef PAIR_KERNELS_H_INCLUDED
+#define PAIR_KERNELS_H_INCLUDED
+
+#include "pteros/core/periodic_box.h"
+#include "pteros/core/grid.h"
+
+namespace pteros {
+
+// Box and cutoff data precomputed once per search for pair distance kernels
+struct Pair_kernel_params {
+    float cutoff2;
+    // 0 - no pbc, 1 - rectangular box, 2 - triclinic box
+    int pbc_mode;
+    // Box and inverted box matrices in column-major order
+    float box[9];
+    float box_inv[9];
+
+    void setup(float cutoff, const Periodic_box& b, bool periodic);
+};
+
+// Finds atoms [b:t.size()) of target cell, which are within cutoff from point (px,py,pz).
+// Local indexes of found atoms in the cell are written to out_j and their
+// squared distances to out_d2. Both buffers should hold t.size() elements.
+// Minimum image convention is applied if periodic is true.
+// Returns the number of found atoms.
+int find_within(const Pair_kernel_params& prm, bool periodic,
+                float px, float py, float pz,
+                const Grid_cell& t, int b,
+                int* out_j, float* out_d2);
+
+// Returns true if any atom [b:t.size()) of target cell is within cutoff from point (px,py,pz).
+bool any_within(const Pair_kernel_params& prm, bool periodic,
+                float px, float py, float pz,
+                const Grid_cell& t, int b);
+
+// Squared distance from p1 to p2. Minimum image convention is applied if periodic is true.
+float pair_distance_squared(const Pair_kernel_params& prm, bool periodic,
+                            Vector3f_const_ref p1, Vector3f_const_ref p2);
+
+// Name of SIMD instruction set used by kernels ("avx512", "avx2" or "scalar")
+const char* pair_kernels_isa();
+
+}
+
+#endif
@@ -37,19 +37,19 @@ using namespace Eigen;
 
 void Grid::clear()
 {    
-    int i,j,k;
-    for(i=0;i<data.shape()[0];++i)
-        for(j=0;j<data.shape()[1];++j)
-            for(k=0;k<data.shape()[2];++k){
-                data[i][j][k].clear();
-        }
-
-    wrapped_atoms.clear();
+    std::fill(offsets.begin(),offsets.end(),0);
+    x.clear();
+    y.clear();
+    z.clear();
+    ind.clear();
 }
 
 void Grid::resize(int X, int Y, int Z)
 {
-    data.resize( boost::extents[X][Y][Z] );
+    NX = X;
+    NY = Y;
+    NZ = Z;
+    offsets.resize(NX*NY*NZ+1);
     clear();
 }
 
@@ -63,32 +63,31 @@ void Grid::populate(const Selection &sel, bool abs_index)
 void Grid::populate(const Selection &sel, Vector3f_const_ref min, Vector3f_const_ref max, bool abs_index)
 {
     int Natoms = sel.size();
-    int NX = data.shape()[0];
-    int NY = data.shape()[1];
-    int NZ = data.shape()[2];
     int n1,n2,n3;
 
+    atom_cell.resize(Natoms);
+    atom_coor.resize(Natoms);
+
     // Non-periodic variant
-    Vector3f* coor;
     for(int i=0;i<Natoms;++i){
         // Get coordinates of atom
-        coor = sel.xyz_ptr(i);
+        const Vector3f& coor = sel.xyz(i);
+        atom_coor[i] = coor;
+        atom_cell[i] = -1;
 
-        n1 = floor(NX*((*coor)(0)-min(0))/(max(0)-min(0)));
+        n1 = floor(NX*(coor(0)-min(0))/(max(0)-min(0)));
         if(n1<0 || n1>=NX) continue;
 
-        n2 = floor(NY*((*coor)(1)-min(1))/(max(1)-min(1)));
+        n2 = floor(NY*(coor(1)-min(1))/(max(1)-min(1)));
         if(n2<0 || n2>=NY) continue;
 
-        n3 = floor(NZ*((*coor)(2)-min(2))/(max(2)-min(2)));
+        n3 = floor(NZ*(coor(2)-min(2))/(max(2)-min(2)));
         if(n3<0 || n3>=NZ) continue;
 
-        if(abs_index){
-            cell(n1,n2,n3).emplace_back(sel.index(i),coor);
-        } else {
-            cell(n1,n2,n3).emplace_back(i,coor);
-        }
+        atom_cell[i] = (n1*NY+n2)*NZ+n3;
     }
+
+    fill_cells(sel,abs_index);
 }
 
 void Grid::populate_periodic(const Selection &sel, bool abs_index)
@@ -99,30 +98,24 @@ void Grid::populate_periodic(const Selection &sel, bool abs_index)
 void Grid::populate_periodic(const Selection &sel, const Periodic_box &box, bool abs_index)
 {
     int Natoms = sel.size();
-    int NX = data.shape()[0];
-    int NY = data.shape()[1];
-    int NZ = data.shape()[2];
     int n1,n2,n3;
 
+    atom_cell.resize(Natoms);
+    atom_coor.resize(Natoms);
+
     // Periodic variant
+    // Atoms are binned in fractional coordinates of the box
     Vector3f coor;
-    Vector3f* ptr;
+    Matrix3f m = box.get_matrix();
     Matrix3f m_inv = box.get_inv_matrix();
 
     for(int i=0;i<Natoms;++i){
-        coor = sel.xyz(i);
-        // See if atom i is in box and wrap if needed
-        if( !box.in_box(coor) ){
-            box.wrap_point(coor);
-            wrapped_atoms.push_back(coor);
-            ptr = &*wrapped_atoms.rbegin();
-        } else {
-            ptr = sel.xyz_ptr(i);
-        }
-
-        // Now we are sure that coor is wrapped
-        // Get relative coordinates in box [0:1)
-        coor = m_inv*coor;
+        // Get relative coordinates in box and wrap them to [0:1)
+        coor = m_inv*sel.xyz(i);
+        coor(0) -= floor(coor(0));
+        coor(1) -= floor(coor(1));
+        coor(2) -= floor(coor(2));
+        atom_coor[i] = m*coor;
 
         n1 = floor(NX*coor(0));
         n2 = floor(NY*coor(1));
@@ -144,13 +137,46 @@ void Grid::populate_periodic(const Selection &sel, const Periodic_box &box, bool
         else if(n3<0)
             n3=0;
 
-        // Assign to grid
-        if(abs_index){
-            cell(n1,n2,n3).emplace_back(sel.index(i),ptr);
-        } else {
-            cell(n1,n2,n3).emplace_back(i,ptr);
-        }
+        atom_cell[i] = (n1*NY+n2)*NZ+n3;
     }
+
+    fill_cells(sel,abs_index);
 }
 
+void Grid::fill_cells(const Selection &sel, bool abs_index)
+{
+    int Natoms = atom_cell.size();
+    int Ncells = NX*NY*NZ;
+    int i,c;
+
+    // Count atoms in each cell. offsets[c+1] holds the count of cell c
+    std::fill(offsets.begin(),offsets.end(),0);
+    for(i=0;i<Natoms;++i){
+        if(atom_cell[i]>=0) ++offsets[atom_cell[i]+1];
+    }
+
+    // Prefix sum gives the start of each cell
+    for(c=0;c<Ncells;++c) offsets[c+1] += offsets[c];
+
+    int N = offsets[Ncells];
+    x.resize(N);
+    y.resize(N);
+    z.resize(N);
+    ind.resize(N);
+
+    // Scatter atoms to their cells. offsets[c] is used as a fill pointer
+    // and is shifted to the end of the cell after that
+    for(i=0;i<Natoms;++i){
+        c = atom_cell[i];
+        if(c<0) continue;
+        int pos = offsets[c]++;
+        x[pos] = atom_coor[i](0);
+        y[pos] = atom_coor[i](1);
+        z[pos] = atom_coor[i](2);
+        ind[pos] = abs_index ? sel.index(i) : i;
+    }
 
+    // Shift offsets back to the beginnings of cells
+    for(c=Ncells;c>0;--c) offsets[c] = offsets[c-1];
+    offsets[0] = 0;
+}
@@ -27,36 +27,40 @@
 */
 
 
+#include "pteros/core/interned_string.h"
+#include <unordered_set>
+#include <mutex>
 
-#ifndef ATOMIC_WRAPPER_H_INCLUDED
-#define ATOMIC_WRAPPER_H_INCLUDED
+using namespace std;
+using namespace pteros;
 
-#include <atomic>
+namespace {
 
-// Wrapper over std::atomic to make it usable in std::vector
-template <typename T>
-struct atomic_wrapper {
-  std::atomic<T> _a;
-
-  atomic_wrapper():_a(){}
-
-  atomic_wrapper(const std::atomic<T> &a):_a(a.load()){}
-
-  atomic_wrapper(const atomic_wrapper &other):_a(other._a.load()){}
-
-  atomic_wrapper &operator=(const atomic_wrapper &other){
-    _a.store(other._a.load());
-  }
+// Process-wide table of strings. Nodes of unordered_set are never moved,
+// so pointers to stored strings stay valid forever. The table is only
+// growing, but the number of distinct atom names, residue names, etc. is small.
+struct Intern_table {
+    unordered_set<string> strings;
+    mutex mut;
+};
 
-  T load(){
-      return _a.load();
-  }
+Intern_table& intern_table(){
+    static Intern_table* table = new Intern_table; // Never destroyed, could be used by static objects
+    return *table;
+}
 
-  void store(const T& v){
-      _a.store(v);
-  }
-};
+}
 
-#endif
+const string* Interned_string::intern(const string &s)
+{
+    auto& t = intern_table();
+    lock_guard<mutex> lock(t.mut);
+    return &*t.strings.insert(s).first;
+}
 
+const string *Interned_string::empty_ptr()
+{
+    static const string* p = intern("");
+    return p;
+}
 
@@ -81,16 +81,13 @@ bool GRO_file::do_read(System *sys, Frame *frame, const Mol_file_content &what){
         getline(f,line);
 
         tmp_atom.resid = atoi(line.substr(0,5).c_str());
-        tmp_atom.resname = line.substr(5,5);
-        tmp_atom.name = line.substr(10,5);
+        tmp_atom.resname = boost::algorithm::trim_copy(line.substr(5,5));
+        tmp_atom.name = boost::algorithm::trim_copy(line.substr(10,5));
         // dum - 5 chars
         tmp_coor(0) = atof(line.substr(20,8).c_str());
         tmp_coor(1) = atof(line.substr(28,8).c_str());
         tmp_coor(2) = atof(line.substr(36,8).c_str());
 
-        boost::algorithm::trim(tmp_atom.resname);
-        boost::algorithm::trim(tmp_atom.name);
-
         // Coordinates are in nm, so no need to convert
 
         if(what.atoms()){
@@ -61,9 +61,72 @@ Mol_file::Mol_file(string& file_name){
 Mol_file::~Mol_file(){    
 }
 
+// Leaves only given atoms in the frame
+static void compact_frame(Frame& fr, const vector<int>& ind){
+    if(int(fr.coord.size())<=ind.back())
+        throw Pteros_error("Atom {} is requested, but trajectory has only {} atoms",ind.back(),fr.coord.size());
+
+    // Indexes are sorted, so atoms are only moved towards the beginning
+    int n = ind.size();
+    for(int i=0;i<n;++i) fr.coord[i] = fr.coord[ind[i]];
+    if(fr.vel.size()==fr.coord.size()){
+        for(int i=0;i<n;++i) fr.vel[i] = fr.vel[ind[i]];
+        fr.vel.resize(n);
+    }
+    if(fr.force.size()==fr.coord.size()){
+        for(int i=0;i<n;++i) fr.force[i] = fr.force[ind[i]];
+        fr.force.resize(n);
+    }
+    fr.coord.resize(n);
+}
+
 bool Mol_file::read(System *sys, Frame *frame, const Mol_file_content &what){
     sanity_check_read(sys,frame,what);    
-    return do_read(sys,frame,what);
+    bool ok = do_read(sys,frame,what);
+    if(ok && what.traj() && atom_subset) compact_frame(*frame,*atom_subset);
+    return ok;
+}
+
+bool Mol_file::read_deferred(Frame *frame, Frame_decoder &decoder){
+    Mol_file_content what;
+    what.traj(true);
+    sanity_check_read(nullptr,frame,what);
+    bool ok = do_read_deferred(frame,decoder);
+    if(ok && atom_subset){
+        if(decoder){
+            // Frame is compacted after decoding, but has its final size already
+            auto sub = atom_subset;
+            int n = frame->coord.size();
+            if(n<=sub->back())
+                throw Pteros_error("Atom {} is requested, but trajectory has only {} atoms",sub->back(),n);
+            decoder = [dec=decoder,sub,n](Frame& fr){
+                fr.coord.resize(n);
+                dec(fr);
+                compact_frame(fr,*sub);
+            };
+            frame->coord.resize(sub->size());
+        } else {
+            compact_frame(*frame,*atom_subset);
+        }
+    }
+    return ok;
+}
+
+void Mol_file::set_atom_subset(const std::vector<int> &ind){
+    if(ind.empty()){
+        atom_subset.reset();
+    } else {
+        atom_subset = make_shared<const vector<int>>(ind);
+    }
+}
+
+int Mol_file::num_atoms_to_read() const {
+    return atom_subset ? std::min(natoms,atom_subset->back()+1) : natoms;
+}
+
+bool Mol_file::do_read_deferred(Frame *frame, Frame_decoder &decoder){
+    decoder = nullptr;
+    return do_read(nullptr,frame,Mol_file_content().traj(true));
 }
 
 void Mol_file::write(const Selection &sel, const Mol_file_content &what) {
@@ -91,6 +154,11 @@ void Mol_file::tell_last_frame_and_time(int &step, float &t)
     throw Pteros_error("Can't report last position - this is not a random-access trajectory");
 }
 
+int64_t Mol_file::tell_current_offset()
+{
+    return -1;
+}
+
 
 void Mol_file::allocate_atoms_in_system(System &sys, int n){
     sys.atoms.resize(n);
@@ -146,7 +214,7 @@ void Mol_file::sanity_check_write(const Selection &sel, const Mol_file_content &
 
 namespace pteros {
 
-void get_element_from_atom_name(string& name, int &anum, float &mass){
+void get_element_from_atom_name(const string& name, int &anum, float &mass){
     // Find first character, which is not digit to account for cases like 21C2
     int i = name.find_first_not_of("1234567890");
 
@@ -38,16 +38,21 @@ using namespace Eigen;
 
 
 void TRR_file::open(char open_mode)
-{    
-    handle = xdrfile_open(fname.c_str(),&open_mode);
-
-    if(!handle) throw Pteros_error("Unable to open TRR file {}", fname);
-
+{
     // Prepare the box just in case
     init_gmx_box(box);
 
-    // -1 for reading means initialization step
-    step = (open_mode=='r') ? -1 : 0;
+    if(open_mode=='r'){
+        // Frames are read as raw bytes and decoded from memory
+        in.open(fname, ios::binary);
+        if(!in) throw Pteros_error("Unable to open TRR file {}", fname);
+        // -1 for reading means initialization step
+        step = -1;
+    } else {
+        handle = xdrfile_open(fname.c_str(),&open_mode);
+        if(!handle) throw Pteros_error("Unable to open TRR file {}", fname);
+        step = 0;
+    }
 }
 
 TRR_file::~TRR_file()
@@ -57,45 +62,80 @@ TRR_file::~TRR_file()
 
 
 bool TRR_file::do_read(System *sys, Frame *frame, const Mol_file_content &what){
-    bool has_x, has_v, has_f, ok;
-
-    if(step<0){
-        // Read header only once on first step
-        int xsz,vsz,fsz;
-        check_trr_content(handle,&natoms,&xsz,&vsz,&fsz);
-        has_x = (xsz>0);
-        has_v = (vsz>0);
-        has_f = (fsz>0);
-        if(!has_x) throw Pteros_error("Pteros can't read TRR files without coordinates!");
+    // Header is read first to get the layout of the frame.
+    // Any frame with coordinates is larger than the header.
+    frame_buf.resize(trr_max_header_size);
+    in.read(frame_buf.data(),trr_max_header_size);
+    if(in.gcount()==0) return false; // End of file
+
+    Trr_frame_header h;
+    try {
+        if(in.gcount()<trr_max_header_size) throw Pteros_error("Frame is truncated");
+        Xdr_reader xdr(frame_buf.data(),frame_buf.size());
+        read_trr_header(xdr,h);
+    } catch(const Pteros_error& e) {
+        LOG()->warn("TRR frame is corrupted: {}",e.what());
+        return false;
     }
 
+    bool has_x = (h.x_size>0);
+    bool has_v = (h.v_size>0);
+    bool has_f = (h.f_size>0);
+
     if(step<0) LOG()->debug("TRR file has: x({}), v({}), f({})",has_x,has_v,has_f);
 
-    rvec* x = nullptr;
-    rvec* v = nullptr;
-    rvec* f = nullptr;
-    if(has_x){
-        frame->coord.resize(natoms);
-        x = (rvec*)frame->coord.data();
-    } else {
-        throw Pteros_error("Pteros can't read TRR files without coordinates!");
+    if(!has_x) throw Pteros_error("Pteros can't read TRR files without coordinates!");
+
+    natoms = h.natoms;
+    int n = num_atoms_to_read();
+    frame->coord.resize(n);
+    // Velocities and forces may be present only in some frames
+    if(has_v) frame->vel.resize(n); else frame->vel.clear();
+    if(has_f) frame->force.resize(n); else frame->force.clear();
+
+    // Read the data following the header. If only the part of atoms is needed
+    // the leading parts of coordinates, velocities and forces are read,
+    // while the rest is skipped.
+    int real_size = h.is_double ? 8 : 4;
+    Trr_frame_header part = h;
+    part.natoms = n;
+    if(has_x) part.x_size = 3*n*real_size;
+    if(has_v) part.v_size = 3*n*real_size;
+    if(has_f) part.f_size = 3*n*real_size;
+
+    frame_buf.resize(part.frame_size()-part.header_size);
+    char* ptr = frame_buf.data();
+    auto read_block = [&](int size, int skip){
+        in.read(ptr,size);
+        ptr += size;
+        if(skip) in.seekg(skip,ios::cur);
+    };
+
+    in.seekg(h.header_size-trr_max_header_size,ios::cur);
+    read_block(h.box_size+h.vir_size+h.pres_size+part.x_size, h.x_size-part.x_size);
+    read_block(part.v_size, h.v_size-part.v_size);
+    read_block(part.f_size, h.f_size-part.f_size);
+    if(!in){
+        LOG()->warn("TRR frame {} is truncated",h.step);
+        return false;
     }
 
-    if(has_v){
-        frame->vel.resize(natoms);
-        v = (rvec*)frame->vel.data();
-    }
-    if(has_f){
-        frame->force.resize(natoms);
-        f = (rvec*)frame->force.data();
-    }
+    Xdr_reader xdr(frame_buf.data(), frame_buf.size());
+    read_trr_data(xdr,part,n,box,
+                  (float*)frame->coord.data(),
+                  has_v ? (float*)frame->vel.data() : nullptr,
+                  has_f ? (float*)frame->force.data() : nullptr);
 
-    float lambda;
-    ok = read_trr(handle,natoms,&step,&frame->time,&lambda,box,x,v,f);
+    step = h.step;
+    frame->time = h.time;
+    gmx_box_to_pteros(box,frame->box);
+    return true;
+}
 
-    // Get box
-    if(ok) gmx_box_to_pteros(box,frame->box);
-    return ok;
+int64_t TRR_file::tell_current_offset()
+{
+    if(!in.is_open()) return -1;
+    return in.tellg();
 }
 
 void TRR_file::do_write(const Selection &sel, const Mol_file_content &what)
@@ -30,6 +30,8 @@
 #pragma once
 
 #include "pteros/core/mol_file.h"
+#include "xdr_codec.h"
+#include <fstream>
 #include "xdrfile.h"
 #include "xdrfile_trr.h"
 
@@ -50,12 +52,18 @@ protected:
 
     virtual void do_write(const Selection &sel, const Mol_file_content& what);
     virtual bool do_read(System *sys, Frame *frame, const Mol_file_content& what);
+    virtual int64_t tell_current_offset() override;
 
 private:
-    // for xdrfile
+    // for writing with xdrfile
     XDRFILE* handle;
     matrix box;
     int step;
+
+    // for reading
+    std::ifstream in;
+    // Raw data of current frame
+    std::vector<char> frame_buf;
 };
 
 }
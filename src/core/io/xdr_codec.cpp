@@ -0,0 +1,428 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+#include "xdr_codec.h"
+#include "pteros/core/pteros_error.h"
+#include <Eigen/Core>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+//-------------------------------------------------------
+// XDR reader
+//-------------------------------------------------------
+
+void Xdr_reader::check(size_t n) const
+{
+    if(size_t(end-ptr)<n) throw Pteros_error("Unexpected end of XDR data");
+}
+
+void Xdr_reader::read_floats(float *out, int n)
+{
+    check(4*size_t(n));
+    // Simple loop over independent elements is vectorized by the compiler
+    for(int i=0;i<n;++i){
+        int v = swap32(ptr+4*i);
+        memcpy(out+i,&v,4);
+    }
+    ptr += 4*size_t(n);
+}
+
+void Xdr_reader::read_doubles(float *out, int n)
+{
+    check(8*size_t(n));
+    for(int i=0;i<n;++i){
+        const char* p = ptr+8*i;
+        uint64_t v = (uint64_t(uint32_t(swap32(p)))<<32) | uint32_t(swap32(p+4));
+        double d;
+        memcpy(&d,&v,8);
+        out[i] = d;
+    }
+    ptr += 8*size_t(n);
+}
+
+//-------------------------------------------------------
+// XTC
+//-------------------------------------------------------
+
+void pteros::read_xtc_header(Xdr_reader &xdr, Xtc_frame_header &header)
+{
+    int magic = xdr.read_int();
+    if(magic!=1995) throw Pteros_error("Wrong magic number {} in XTC frame",magic);
+    header.natoms = xdr.read_int();
+    header.step = xdr.read_int();
+    header.time = xdr.read_float();
+    xdr.read_floats(header.box[0],9);
+}
+
+namespace {
+
+// Compressed coordinate routines, ported from xdrfile by Frans v. Hoesel
+
+const int magicints[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+    80, 101, 128, 161, 203, 256, 322, 406, 512, 645, 812, 1024, 1290,
+    1625, 2048, 2580, 3250, 4096, 5060, 6501, 8192, 10321, 13003,
+    16384, 20642, 26007, 32768, 41285, 52015, 65536,82570, 104031,
+    131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561,
+    832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021,
+    4194304, 5284491, 6658042, 8388607, 10568983, 13316085, 16777216
+};
+
+constexpr int FIRSTIDX = 9;
+constexpr int LASTIDX = sizeof(magicints)/sizeof(*magicints);
+
+// Smallest number of bits necessary to represent an integer
+int sizeofint(int size){
+    unsigned int num = 1;
+    int num_of_bits = 0;
+    while(unsigned(size)>=num && num_of_bits<32){
+        num_of_bits++;
+        num <<= 1;
+    }
+    return num_of_bits;
+}
+
+// Number of bits needed to store a set of small integers with given maximal values
+int sizeofints(int num_of_ints, const unsigned int sizes[]){
+    unsigned int num_of_bytes, num_of_bits, bytes[32], bytecnt, tmp, num;
+    num_of_bytes = 1;
+    bytes[0] = 1;
+    num_of_bits = 0;
+    for(int i=0; i<num_of_ints; i++){
+        tmp = 0;
+        for(bytecnt = 0; bytecnt < num_of_bytes; bytecnt++){
+            tmp = bytes[bytecnt] * sizes[i] + tmp;
+            bytes[bytecnt] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        while(tmp != 0){
+            bytes[bytecnt++] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        num_of_bytes = bytecnt;
+    }
+    num = 1;
+    num_of_bytes--;
+    while(bytes[num_of_bytes] >= num){
+        num_of_bits++;
+        num *= 2;
+    }
+    return num_of_bits + num_of_bytes * 8;
+}
+
+// Reader of bit stream of compressed coordinates
+class Bit_reader {
+public:
+    Bit_reader(const unsigned char* data, int size):
+        cbuf(data), size(size), cnt(0), lastbits(0), lastbyte(0) {}
+
+    int decodebits(int num_of_bits){
+        int num = 0;
+        int mask = (1 << num_of_bits) - 1;
+        while(num_of_bits >= 8){
+            lastbyte = (lastbyte << 8) | next_byte();
+            num |= (lastbyte >> lastbits) << (num_of_bits - 8);
+            num_of_bits -= 8;
+        }
+        if(num_of_bits > 0){
+            if(lastbits < unsigned(num_of_bits)){
+                lastbits += 8;
+                lastbyte = (lastbyte << 8) | next_byte();
+            }
+            lastbits -= num_of_bits;
+            num |= (lastbyte >> lastbits) & ((1 << num_of_bits) - 1);
+        }
+        return num & mask;
+    }
+
+    void decodeints(int num_of_ints, int num_of_bits, const unsigned int sizes[], int nums[]){
+        int bytes[32];
+        int i, j, num_of_bytes, p, num;
+
+        bytes[1] = bytes[2] = bytes[3] = 0;
+        num_of_bytes = 0;
+        while(num_of_bits > 8){
+            bytes[num_of_bytes++] = decodebits(8);
+            num_of_bits -= 8;
+        }
+        if(num_of_bits > 0){
+            bytes[num_of_bytes++] = decodebits(num_of_bits);
+        }
+        for(i = num_of_ints-1; i > 0; i--){
+            num = 0;
+            for(j = num_of_bytes-1; j >= 0; j--){
+                num = (num << 8) | bytes[j];
+                p = num / sizes[i];
+                bytes[j] = p;
+                num = num - p * sizes[i];
+            }
+            nums[i] = num;
+        }
+        nums[0] = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+    }
+
+private:
+    const unsigned char* cbuf;
+    int size;
+    int cnt;
+    unsigned int lastbits;
+    unsigned int lastbyte;
+
+    unsigned int next_byte(){
+        if(cnt>=size) throw Pteros_error("Buffer overrun in XTC compressed coordinates");
+        return cbuf[cnt++];
+    }
+};
+
+} // namespace
+
+
+float Xtc_decoder::decode(Xdr_reader &xdr, int natoms, int n, float *out)
+{
+    int lsize = xdr.read_int();
+    if(lsize!=natoms) throw Pteros_error("XTC frame has {} atoms instead of {}",lsize,natoms);
+    if(n<0 || n>natoms) n = natoms;
+
+    // Coordinates of small systems are not compressed
+    if(natoms<=9){
+        if(n==natoms){
+            xdr.read_floats(out,3*n);
+        } else {
+            float tmp[27];
+            xdr.read_floats(tmp,3*natoms);
+            copy(tmp,tmp+3*n,out);
+        }
+        return 0;
+    }
+
+    float precision = xdr.read_float();
+
+    int minint[3], maxint[3];
+    for(int i=0;i<3;++i) minint[i] = xdr.read_int();
+    for(int i=0;i<3;++i) maxint[i] = xdr.read_int();
+
+    unsigned int sizeint[3], sizesmall[3], bitsizeint[3] = {0,0,0};
+    unsigned int bitsize;
+    for(int i=0;i<3;++i) sizeint[i] = maxint[i] - minint[i] + 1;
+
+    // Check if one of the sizes is to big to be multiplied
+    if((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff){
+        for(int i=0;i<3;++i) bitsizeint[i] = sizeofint(sizeint[i]);
+        bitsize = 0; // flag the use of large sizes
+    } else {
+        bitsize = sizeofints(3, sizeint);
+    }
+
+    int smallidx = xdr.read_int();
+    if(smallidx<FIRSTIDX || smallidx>=LASTIDX) throw Pteros_error("Wrong XTC compression index {}",smallidx);
+    int smaller = magicints[std::max(FIRSTIDX, smallidx-1)] / 2;
+    int smallnum = magicints[smallidx] / 2;
+    sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+
+    int nbytes = xdr.read_int();
+    Bit_reader bits((const unsigned char*)xdr.read_opaque(nbytes), nbytes);
+
+    // Integer coordinates are decoded to the buffer first. A run may add up to
+    // 10 atoms after the target one, so buffer is a bit larger than needed.
+    int nbuf = std::min(natoms, n+11);
+    if(int(ibuf.size())<3*nbuf) ibuf.resize(3*nbuf);
+    int* lip = ibuf.data();
+
+    int prevcoord[3];
+    int run = 0;
+    int i = 0;
+    while(i<n){
+        int* thiscoord = lip + i*3;
+
+        if(bitsize == 0){
+            thiscoord[0] = bits.decodebits(bitsizeint[0]);
+            thiscoord[1] = bits.decodebits(bitsizeint[1]);
+            thiscoord[2] = bits.decodebits(bitsizeint[2]);
+        } else {
+            bits.decodeints(3, bitsize, sizeint, thiscoord);
+        }
+
+        i++;
+        thiscoord[0] += minint[0];
+        thiscoord[1] += minint[1];
+        thiscoord[2] += minint[2];
+
+        prevcoord[0] = thiscoord[0];
+        prevcoord[1] = thiscoord[1];
+        prevcoord[2] = thiscoord[2];
+
+        int flag = bits.decodebits(1);
+        int is_smaller = 0;
+        if(flag == 1){
+            run = bits.decodebits(5);
+            is_smaller = run % 3;
+            run -= is_smaller;
+            is_smaller--;
+        }
+
+        if(run > 0){
+            if(i+run/3 > natoms) throw Pteros_error("Buffer overrun during decompression of XTC frame");
+            thiscoord += 3;
+            for(int k = 0; k < run; k+=3){
+                bits.decodeints(3, smallidx, sizesmall, thiscoord);
+                i++;
+                thiscoord[0] += prevcoord[0] - smallnum;
+                thiscoord[1] += prevcoord[1] - smallnum;
+                thiscoord[2] += prevcoord[2] - smallnum;
+                if(k == 0){
+                    // Interchange first with second atom for better
+                    // compression of water molecules
+                    std::swap(thiscoord[0],prevcoord[0]);
+                    std::swap(thiscoord[1],prevcoord[1]);
+                    std::swap(thiscoord[2],prevcoord[2]);
+                    thiscoord[-3] = prevcoord[0];
+                    thiscoord[-2] = prevcoord[1];
+                    thiscoord[-1] = prevcoord[2];
+                } else {
+                    prevcoord[0] = thiscoord[0];
+                    prevcoord[1] = thiscoord[1];
+                    prevcoord[2] = thiscoord[2];
+                }
+                thiscoord += 3;
+            }
+        }
+
+        smallidx += is_smaller;
+        if(is_smaller < 0){
+            smallnum = smaller;
+            if(smallidx > FIRSTIDX){
+                smaller = magicints[smallidx - 1] / 2;
+            } else {
+                smaller = 0;
+            }
+        } else if(is_smaller > 0){
+            smaller = smallnum;
+            smallnum = magicints[smallidx] / 2;
+        }
+        if(smallidx<FIRSTIDX || smallidx>=LASTIDX) throw Pteros_error("Wrong XTC compression index {}",smallidx);
+        sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+    }
+
+    // Conversion of integer coordinates to floats is vectorized
+    float inv_precision = 1.0 / precision;
+    Map<ArrayXf>(out,3*n) = Map<ArrayXi>(lip,3*n).cast<float>() * inv_precision;
+
+    return precision;
+}
+
+//-------------------------------------------------------
+// TRR
+//-------------------------------------------------------
+
+void pteros::read_trr_header(Xdr_reader &xdr, Trr_frame_header &header)
+{
+    size_t start = xdr.bytes_left();
+    int magic = xdr.read_int();
+    if(magic!=1993) throw Pteros_error("Wrong magic number {} in TRR frame",magic);
+    // Version string "GMX_trn_file" is stored with its length twice
+    xdr.read_int();
+    int slen = xdr.read_int();
+    xdr.read_opaque(slen);
+
+    int ir_size = xdr.read_int();
+    int e_size = xdr.read_int();
+    header.box_size = xdr.read_int();
+    header.vir_size = xdr.read_int();
+    header.pres_size = xdr.read_int();
+    int top_size = xdr.read_int();
+    int sym_size = xdr.read_int();
+    header.x_size = xdr.read_int();
+    header.v_size = xdr.read_int();
+    header.f_size = xdr.read_int();
+    header.natoms = xdr.read_int();
+    header.step = xdr.read_int();
+    xdr.read_int(); // nre
+
+    if(ir_size || e_size || top_size || sym_size)
+        throw Pteros_error("Unsupported content of TRR frame");
+
+    // Precision is deduced from the size of stored data
+    int nflsize;
+    if(header.box_size)
+        nflsize = header.box_size/9;
+    else if(header.x_size)
+        nflsize = header.x_size/(header.natoms*3);
+    else if(header.v_size)
+        nflsize = header.v_size/(header.natoms*3);
+    else if(header.f_size)
+        nflsize = header.f_size/(header.natoms*3);
+    else
+        throw Pteros_error("Empty TRR frame");
+
+    if(nflsize!=sizeof(float) && nflsize!=sizeof(double))
+        throw Pteros_error("Wrong size of real numbers in TRR frame");
+    header.is_double = (nflsize==sizeof(double));
+
+    if(header.is_double){
+        header.time = xdr.read_double();
+        header.lambda = xdr.read_double();
+    } else {
+        header.time = xdr.read_float();
+        header.lambda = xdr.read_float();
+    }
+    header.header_size = start-xdr.bytes_left();
+}
+
+namespace {
+
+// Reads a block of TRR data converting first n entries
+void read_trr_block(Xdr_reader& xdr, bool is_double, int size, int n, float* out){
+    if(size==0) return;
+    int real_size = is_double ? 8 : 4;
+    if(out){
+        if(is_double)
+            xdr.read_doubles(out,n);
+        else
+            xdr.read_floats(out,n);
+        xdr.skip(size-n*real_size);
+    } else {
+        xdr.skip(size);
+    }
+}
+
+}
+
+void pteros::read_trr_data(Xdr_reader &xdr, const Trr_frame_header &header, int n,
+                           matrix box, float *x, float *v, float *f)
+{
+    if(n<0 || n>header.natoms) n = header.natoms;
+    read_trr_block(xdr,header.is_double,header.box_size,9,box ? box[0] : nullptr);
+    read_trr_block(xdr,header.is_double,header.vir_size,9,nullptr);
+    read_trr_block(xdr,header.is_double,header.pres_size,9,nullptr);
+    read_trr_block(xdr,header.is_double,header.x_size,3*n,x);
+    read_trr_block(xdr,header.is_double,header.v_size,3*n,v);
+    read_trr_block(xdr,header.is_double,header.f_size,3*n,f);
+}
+
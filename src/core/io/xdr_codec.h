@@ -0,0 +1,169 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+#pragma once
+
+#include "gromacs_utils.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace pteros {
+
+/// Reader of big-endian XDR data from memory buffer.
+/// Throws if data are read past the end of buffer.
+class Xdr_reader {
+public:
+    Xdr_reader(const char* data, size_t size): ptr(data), end(data+size) {}
+
+    int read_int(){
+        check(4);
+        int v = swap32(ptr);
+        ptr += 4;
+        return v;
+    }
+
+    float read_float(){
+        int v = read_int();
+        float f;
+        memcpy(&f,&v,4);
+        return f;
+    }
+
+    double read_double(){
+        check(8);
+        uint64_t v = (uint64_t(uint32_t(swap32(ptr)))<<32) | uint32_t(swap32(ptr+4));
+        ptr += 8;
+        double d;
+        memcpy(&d,&v,8);
+        return d;
+    }
+
+    /// Reads n floats
+    void read_floats(float* out, int n);
+
+    /// Reads n doubles and converts them to floats
+    void read_doubles(float* out, int n);
+
+    /// Returns pointer to n bytes of opaque data and skips them including padding
+    const char* read_opaque(int n){
+        const char* p = ptr;
+        skip((n+3)/4*4);
+        return p;
+    }
+
+    void skip(size_t n){
+        check(n);
+        ptr += n;
+    }
+
+    size_t bytes_left() const { return end-ptr; }
+
+private:
+    const char* ptr;
+    const char* end;
+
+    void check(size_t n) const;
+
+    static int swap32(const char* p){
+        uint32_t v;
+        memcpy(&v,p,4);
+        return int( (v>>24) | ((v>>8)&0xff00) | ((v<<8)&0xff0000) | (v<<24) );
+    }
+};
+
+
+/// Header and box of XTC frame
+struct Xtc_frame_header {
+    int natoms;
+    int step;
+    float time;
+    matrix box;
+};
+
+/// Size of XTC frame header including the box in bytes
+constexpr int xtc_header_size = 52;
+
+/// Reads XTC frame header and the box
+void read_xtc_header(Xdr_reader& xdr, Xtc_frame_header& header);
+
+/// Decoder of XTC compressed coordinates.
+/// Buffers are reused between frames, so one decoder should be
+/// kept for all frames of a trajectory in each thread.
+class Xtc_decoder {
+public:
+    /// Decodes the coordinates, which follow the header of the frame.
+    /// Only the first n atoms are decoded and written to out, which
+    /// should have space for 3*n floats. The rest of frame is not decompressed.
+    /// Returns precision of coordinates.
+    float decode(Xdr_reader& xdr, int natoms, int n, float* out);
+
+private:
+    std::vector<int> ibuf;
+};
+
+
+/// Header of TRR frame
+struct Trr_frame_header {
+    bool is_double;
+    int box_size;
+    int vir_size;
+    int pres_size;
+    int x_size;
+    int v_size;
+    int f_size;
+    int natoms;
+    int step;
+    float time;
+    float lambda;
+    /// Size of the header in bytes
+    int header_size;
+
+    /// Size of the whole frame in bytes
+    size_t frame_size() const {
+        return header_size+box_size+vir_size+pres_size+x_size+v_size+f_size;
+    }
+};
+
+/// Size of TRR header in double precision. Header in single precision is smaller.
+constexpr int trr_max_header_size = 92;
+
+/// Reads TRR frame header
+void read_trr_header(Xdr_reader& xdr, Trr_frame_header& header);
+
+/// Reads the data of TRR frame, which follow the header.
+/// Only the first n atoms of coordinates, velocities and forces are
+/// converted, while the rest is skipped. Any of box, x, v and f could be
+/// nullptr if not needed.
+void read_trr_data(Xdr_reader& xdr, const Trr_frame_header& header, int n,
+                   matrix box, float* x, float* v, float* f);
+
+}
+
+
+
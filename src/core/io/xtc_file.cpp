@@ -31,54 +31,190 @@
 #include "pteros/core/logging.h"
 #include "gromacs_utils.h"
 #include "xdr_utils.h"
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
 
 using namespace std;
 using namespace pteros;
 using namespace Eigen;
 
 
+// Frame index is stored in the sidecar file next to trajectory.
+// It is valid while the size and modification time of trajectory are the same.
+static const char xtc_index_magic[8] = "PTIDX02";
+
+struct Xtc_index_header {
+    char magic[8];
+    int64_t file_size;
+    int64_t mtime;
+    int64_t data_end;
+    int32_t natoms;
+    int32_t num_frames;
+};
+
 void XTC_file::open(char open_mode)
 {
-    bool bOk;
-    handle = xdrfile_open(fname.c_str(),&open_mode);
+    // Prepare the box just in case
+    init_gmx_box(box);
 
-    if(!handle) throw Pteros_error("Unable to open XTC file {}", fname);
+    if(open_mode=='r'){
+        // Frames are read as raw bytes and decoded from memory
+        in.open(fname, ios::binary);
+        if(!in) throw Pteros_error("Unable to open XTC file {}", fname);
 
-    // Extract number of atoms
-    int ok = xdr_xtc_get_natoms(handle,&natoms);
-    if(!ok) throw Pteros_error("Can't read XTC number of atoms");
+        // Extract number of atoms
+        char buf[xtc_header_size];
+        in.read(buf,xtc_header_size);
+        if(!in) throw Pteros_error("Can't read XTC number of atoms");
+        Xdr_reader xdr(buf,xtc_header_size);
+        Xtc_frame_header h;
+        read_xtc_header(xdr,h);
+        natoms = h.natoms;
 
-    // XTC file contains step number in terms of simulation steps, not saved frames
-    // So we have to extract conversion factor
-    int next = xtc_get_next_frame_number(handle,natoms);
-    int cur = xtc_get_current_frame_number(handle,natoms,&bOk);
-    if(cur<0 || next<0 || !bOk) throw Pteros_error("Can't detect number of steps per frame");
-    steps_per_frame = next-cur;
+        // Get offsets of all frames from index
+        int64_t file_size = boost::filesystem::file_size(fname);
+        int64_t mtime = boost::filesystem::last_write_time(fname);
+        string index_name = fname+".ptidx";
 
-    // Get total number of frames in the trajectory
-    num_frames = xdr_xtc_get_last_frame_number(handle,natoms,&bOk);
-    if(num_frames<0 || !bOk) throw Pteros_error("Can't get number of frames");
-    num_frames /= steps_per_frame;
+        if(!load_index(index_name,file_size,mtime)){
+            build_index(file_size);
+            save_index(index_name,file_size,mtime);
+        }
 
-    // Get time step
-    dt = xdr_xtc_estimate_dt(handle,natoms,&bOk);
-    if(!bOk) throw Pteros_error("Can't get time step");    
+        if(frame_offset.empty()) throw Pteros_error("No frames in XTC file {}", fname);
+
+        LOG()->debug("There are {} frames, max_t= {}",frame_offset.size(),frame_time.back());
+
+        cur_frame = 0;
+        // -1 for reading means initialization step
+        step = -1;
+    } else {
+        handle = xdrfile_open(fname.c_str(),&open_mode);
+        if(!handle) throw Pteros_error("Unable to open XTC file {}", fname);
+        step = 0;
+    }
+}
 
-    max_t = xdr_xtc_get_last_frame_time(handle,natoms,&bOk);
-    if(!bOk || max_t<0) throw Pteros_error("Can't get last frame time");
+void XTC_file::build_index(int64_t file_size)
+{
+    // XTC frame consists of header (magic, natoms, step, time), box (9 floats)
+    // and coordinates prefixed by natoms. Compressed coordinates are stored
+    // as precision, minint[3], maxint[3], smallidx and opaque bytes prefixed
+    // by their count. Thus the size of each frame is known from its header
+    // and frames are visited without decompression.
+    frame_offset.clear();
+    frame_step.clear();
+    frame_time.clear();
 
-    LOG()->debug("There are {} frames, max_t= {}, dt={}",num_frames,max_t,dt);
+    const int nhead = (natoms<=9) ? xtc_header_size : xtc_header_size+40;
+    char buf[xtc_header_size+40];
+    Xtc_frame_header h;
+    int64_t pos = 0;
 
+    while(pos<file_size){
+        in.seekg(pos);
+        in.read(buf,nhead);
+        if(in.gcount()<nhead){
+            LOG()->warn("XTC frame at offset {} is truncated",pos);
+            break;
+        }
 
+        int64_t frame_size;
+        try {
+            Xdr_reader xdr(buf,nhead);
+            read_xtc_header(xdr,h);
+            if(h.natoms!=natoms) throw Pteros_error("Wrong number of atoms");
+            if(natoms<=9){
+                frame_size = xtc_header_size + 4 + 12*natoms;
+            } else {
+                // Skip natoms, precision, minint, maxint and smallidx
+                xdr.skip(36);
+                frame_size = nhead + (xdr.read_int()+3)/4*4;
+            }
+        } catch(const Pteros_error&) {
+            LOG()->warn("XTC frame at offset {} is corrupted, ignoring the rest of file",pos);
+            break;
+        }
 
+        if(pos+frame_size>file_size){
+            LOG()->warn("XTC frame at offset {} is truncated",pos);
+            break;
+        }
 
-    if(!handle) throw Pteros_error("Unable to open XTC file {}", fname);
+        frame_offset.push_back(pos);
+        frame_step.push_back(h.step);
+        frame_time.push_back(h.time);
+        pos += frame_size;
+    }
 
-    // Prepare the box just in case
-    init_gmx_box(box);
+    data_end = pos;
 
-    // -1 for reading means initialization step
-    step = (open_mode=='r') ? -1 : 0;
+    // Stream may be at EOF after the last frame
+    in.clear();
+}
+
+bool XTC_file::load_index(const string &index_name, int64_t file_size, int64_t mtime)
+{
+    ifstream f(index_name, ios::binary);
+    if(!f) return false;
+
+    Xtc_index_header h;
+    f.read((char*)&h,sizeof(h));
+    if(!f || strncmp(h.magic,xtc_index_magic,8)!=0
+       || h.file_size!=file_size || h.mtime!=mtime || h.natoms!=natoms){
+        LOG()->debug("XTC index {} is outdated",index_name);
+        return false;
+    }
+
+    data_end = h.data_end;
+    frame_offset.resize(h.num_frames);
+    frame_step.resize(h.num_frames);
+    frame_time.resize(h.num_frames);
+    f.read((char*)frame_offset.data(),h.num_frames*sizeof(int64_t));
+    f.read((char*)frame_step.data(),h.num_frames*sizeof(int));
+    f.read((char*)frame_time.data(),h.num_frames*sizeof(float));
+    if(!f){
+        LOG()->debug("XTC index {} is corrupted",index_name);
+        return false;
+    }
+
+    LOG()->debug("Loaded XTC index {}",index_name);
+    return true;
+}
+
+void XTC_file::save_index(const string &index_name, int64_t file_size, int64_t mtime)
+{
+    // Index is written to unique temporary file and renamed atomically,
+    // since several processes may read the same trajectory at once
+    string tmp_name = index_name + "." + boost::filesystem::unique_path().string() + ".tmp";
+    ofstream f(tmp_name, ios::binary);
+    // Trajectory may be in read-only location, index is just not saved then
+    if(!f){
+        LOG()->debug("Can't write XTC index {}",index_name);
+        return;
+    }
+
+    Xtc_index_header h;
+    strncpy(h.magic,xtc_index_magic,8);
+    h.file_size = file_size;
+    h.mtime = mtime;
+    h.data_end = data_end;
+    h.natoms = natoms;
+    h.num_frames = frame_offset.size();
+    f.write((char*)&h,sizeof(h));
+    f.write((char*)frame_offset.data(),h.num_frames*sizeof(int64_t));
+    f.write((char*)frame_step.data(),h.num_frames*sizeof(int));
+    f.write((char*)frame_time.data(),h.num_frames*sizeof(float));
+    f.close();
+
+    boost::system::error_code ec;
+    if(f) boost::filesystem::rename(tmp_name,index_name,ec);
+    if(!f || ec){
+        LOG()->debug("Can't write XTC index {}",index_name);
+        boost::filesystem::remove(tmp_name,ec);
+    }
 }
 
 XTC_file::~XTC_file()
@@ -86,58 +222,127 @@ XTC_file::~XTC_file()
     if(handle) xdrfile_close(handle);
 }
 
+bool XTC_file::read_frame_bytes(std::vector<char> &buf)
+{
+    if(cur_frame>=int(frame_offset.size())) return false; // End of file
+
+    int64_t pos = frame_offset[cur_frame];
+    int64_t end = (cur_frame+1<int(frame_offset.size())) ? frame_offset[cur_frame+1] : data_end;
+    buf.resize(end-pos);
+    in.seekg(pos);
+    in.read(buf.data(),buf.size());
+    if(!in) throw Pteros_error("Error reading XTC frame {}",cur_frame);
+
+    ++cur_frame;
+    return true;
+}
+
 bool XTC_file::do_read(System *sys, Frame *frame, const Mol_file_content &what){
-    float prec;
-    int ret;
+    // Atoms are stored in order, so only the leading part of frame is decoded if possible
+    int n = num_atoms_to_read();
+    frame->coord.resize(n);
+    if(!read_frame_bytes(frame_buf)) return false;
 
-    frame->coord.resize(natoms);
-    ret = read_xtc(handle,natoms,&step,&frame->time,box, (rvec*)frame->coord.data(), &prec);
-    if(ret == exdrENDOFFILE) return false; // End of file
-    if(ret != exdrOK){
-        LOG()->warn("XTC frame {} is corrupted!",step);
+    float prec;
+    try {
+        Xdr_reader xdr(frame_buf.data(),frame_buf.size());
+        Xtc_frame_header h;
+        read_xtc_header(xdr,h);
+        prec = xtc_decoder.decode(xdr,natoms,n,(float*)frame->coord.data());
+        frame->time = h.time;
+        gmx_box_to_pteros(h.box,frame->box);
+    } catch(const Pteros_error& e) {
+        LOG()->warn("XTC frame {} is corrupted: {}",cur_frame-1,e.what());
         return false;
     }
 
-    if(step==0){
+    if(step<0){
         LOG()->debug("Number of atoms: {}",natoms);
         LOG()->debug("XTC precision: {}",prec);
+        step = 0;
+    }
+
+    return true;
+}
+
+bool XTC_file::do_read_deferred(Frame *frame, Frame_decoder &decoder)
+{
+    // Only the header and the box are decoded here. Compressed coordinates
+    // are decoded later from the raw data of the frame.
+    int n = num_atoms_to_read();
+    frame->coord.resize(n);
+
+    // Raw data buffers are reused after the decoders holding them are released
+    shared_ptr<vector<char>> buf;
+    for(auto& b: raw_bufs){
+        if(b.use_count()==1){
+            // Synchronize with the release of the buffer by other thread
+            atomic_thread_fence(memory_order_acquire);
+            buf = b;
+            break;
+        }
+    }
+    if(!buf){
+        buf = make_shared<vector<char>>();
+        raw_bufs.push_back(buf);
     }
+    if(!read_frame_bytes(*buf)) return false;
+
+    try {
+        Xdr_reader xdr(buf->data(),buf->size());
+        Xtc_frame_header h;
+        read_xtc_header(xdr,h);
+        frame->time = h.time;
+        gmx_box_to_pteros(h.box,frame->box);
+    } catch(const Pteros_error& e) {
+        LOG()->warn("XTC frame {} is corrupted: {}",cur_frame-1,e.what());
+        return false;
+    }
+
+    int nat = natoms;
+    decoder = [buf,nat,n](Frame& fr){
+        // Buffers of decoder are reused by each thread
+        static thread_local Xtc_decoder dec;
+        Xdr_reader xdr(buf->data()+xtc_header_size,buf->size()-xtc_header_size);
+        dec.decode(xdr,nat,n,(float*)fr.coord.data());
+    };
 
-    gmx_box_to_pteros(box,frame->box);
     return true;
 }
 
 
 void XTC_file::seek_frame(int fr)
 {
-    if(fr>=num_frames) throw Pteros_error("Can't seek to frame {}, there are {} frames in this file",fr,num_frames);
-    int ret = xdr_xtc_seek_frame(fr*steps_per_frame,handle,natoms);
-    if(ret<0) throw Pteros_error("Error seeking to frame {}",fr,num_frames);
+    if(fr<0 || fr>=int(frame_offset.size()))
+        throw Pteros_error("Can't seek to frame {}, there are {} frames in this file",fr,frame_offset.size());
+    cur_frame = fr;
 }
 
 void XTC_file::seek_time(float t)
 {
-    if(t<0 || t>max_t) throw Pteros_error("Can't seek to time {}, last time is {}",t,max_t);
-    // We assume equally spaced frames in the trajectory. It's much faster
-    int ret = xdr_xtc_seek_frame(ceil(t/dt)*steps_per_frame,handle,natoms);
-    //int ret = xdr_xtc_seek_time(t,handle,natoms,false);
-    if(ret<0) throw Pteros_error("Can't seek to time {}",t,num_frames);
+    if(t<0 || t>frame_time.back()) throw Pteros_error("Can't seek to time {}, last time is {}",t,frame_time.back());
+    // Time of frames is taken from index, so frames don't have to be equally spaced
+    int fr = lower_bound(frame_time.begin(),frame_time.end(),t) - frame_time.begin();
+    seek_frame(fr);
 }
 
 void XTC_file::tell_current_frame_and_time(int &step, float &t)
 {
-    bool bOk;
-    int ret = xtc_get_current_frame_number(handle,natoms,&bOk);
-    if(!bOk || ret<0) throw Pteros_error("Can't get current frame number");
-    step = ret/steps_per_frame;
-    t = xtc_get_current_frame_time(handle,natoms,&bOk);
-    if(!bOk || t<0) throw Pteros_error("Can't get current frame time");
+    // Frame, which is going to be read next or the last one at the end of file
+    step = std::min<int>(cur_frame,frame_offset.size()-1);
+    t = frame_time[step];
 }
 
 void XTC_file::tell_last_frame_and_time(int &step, float &t)
 {
-    step = num_frames;
-    t = max_t;
+    step = frame_offset.size();
+    t = frame_time.back();
+}
+
+int64_t XTC_file::tell_current_offset()
+{
+    if(!in.is_open()) return -1;
+    return (cur_frame<int(frame_offset.size())) ? frame_offset[cur_frame] : data_end;
 }
 
 void XTC_file::do_write(const Selection &sel, const Mol_file_content &what)
@@ -31,6 +31,8 @@
 #pragma once
 
 #include "pteros/core/mol_file.h"
+#include "xdr_codec.h"
+#include <fstream>
 
 #include "xdrfile.h"
 #include "xdrfile_xtc.h"
@@ -40,7 +42,7 @@ namespace pteros {
 
 class XTC_file: public Mol_file {
 public:
-    XTC_file(std::string& fname): Mol_file(fname), handle(nullptr) {}
+    XTC_file(std::string& fname): Mol_file(fname), handle(nullptr), cur_frame(0), data_end(0) {}
     virtual void open(char open_mode);
     virtual ~XTC_file();
 
@@ -52,20 +54,43 @@ protected:
 
     virtual void do_write(const Selection &sel, const Mol_file_content& what) override;
     virtual bool do_read(System *sys, Frame *frame, const Mol_file_content& what) override ;
+    virtual bool do_read_deferred(Frame* frame, Frame_decoder& decoder) override;
 
     virtual void seek_frame(int fr) override;
     virtual void seek_time(float t) override;
     virtual void tell_current_frame_and_time(int& step, float& t) override;
     virtual void tell_last_frame_and_time(int& step, float& t) override;
+    virtual int64_t tell_current_offset() override;
 
 private:
-    // for xdrfile
+    // for writing with xdrfile
     XDRFILE* handle;
     matrix box;
     int step;
-    int steps_per_frame;
-    int64_t num_frames;
-    float dt, max_t;
+
+    // for reading
+    std::ifstream in;
+    // Frame to be read next
+    int cur_frame;
+    // Raw data of current frame
+    std::vector<char> frame_buf;
+    // Raw data of frames with deferred decoding
+    std::vector<std::shared_ptr<std::vector<char>>> raw_bufs;
+    Xtc_decoder xtc_decoder;
+
+    // Index of frames: byte offsets, steps and times
+    std::vector<int64_t> frame_offset;
+    std::vector<int> frame_step;
+    std::vector<float> frame_time;
+    // End of the last valid frame
+    int64_t data_end;
+
+    // Reads raw data of the current frame and advances to the next one
+    bool read_frame_bytes(std::vector<char>& buf);
+
+    void build_index(int64_t file_size);
+    bool load_index(const std::string& index_name, int64_t file_size, int64_t mtime);
+    void save_index(const std::string& index_name, int64_t file_size, int64_t mtime);
 };
 
 }
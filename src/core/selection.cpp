@@ -30,6 +30,7 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <numeric>
 #include <set>
 #include <map>
 #include <boost/algorithm/string.hpp> // String algorithms
@@ -62,6 +63,102 @@ using namespace std;
 using namespace pteros;
 using namespace Eigen;
 
+//-----------------------------------------------------
+// Contiguous runs of indexes [first,last) are used to speed up
+// union and difference of dense selections
+//-----------------------------------------------------
+
+// Converts sorted index to runs. Returns false if index is too fragmented,
+// which means that per-element processing is faster.
+static bool index_to_runs(const vector<int>& ind, vector<Vector2i>& runs){
+    runs.clear();
+    int n = ind.size();
+    if(n==0) return true;
+    int max_runs = n/8+1;
+    int b = ind[0];
+    for(int i=1;i<n;++i){
+        if(ind[i]!=ind[i-1]+1){
+            runs.emplace_back(b,ind[i-1]+1);
+            if(int(runs.size())>max_runs) return false;
+            b = ind[i];
+        }
+    }
+    runs.emplace_back(b,ind[n-1]+1);
+    return true;
+}
+
+static void runs_to_index(const vector<Vector2i>& runs, vector<int>& ind){
+    int n = 0;
+    for(const auto& r: runs) n += r(1)-r(0);
+    ind.resize(n);
+    auto it = ind.begin();
+    for(const auto& r: runs){
+        iota(it,it+r(1)-r(0),r(0));
+        it += r(1)-r(0);
+    }
+}
+
+// Appends run to sorted runs merging it with the last one if they overlap or touch
+static void append_run(vector<Vector2i>& runs, int b, int e){
+    if(!runs.empty() && runs.back()(1)>=b)
+        runs.back()(1) = std::max(runs.back()(1),e);
+    else
+        runs.emplace_back(b,e);
+}
+
+static void runs_union(const vector<Vector2i>& r1, const vector<Vector2i>& r2, vector<Vector2i>& res){
+    int i=0, j=0;
+    int n1 = r1.size(), n2 = r2.size();
+    while(i<n1 || j<n2){
+        if(j==n2 || (i<n1 && r1[i](0)<r2[j](0))){
+            append_run(res,r1[i](0),r1[i](1));
+            ++i;
+        } else {
+            append_run(res,r2[j](0),r2[j](1));
+            ++j;
+        }
+    }
+}
+
+static void runs_difference(const vector<Vector2i>& r1, const vector<Vector2i>& r2, vector<Vector2i>& res){
+    int j=0, n2 = r2.size();
+    for(const auto& r: r1){
+        int b = r(0);
+        // Skip runs, which are completely before current one
+        while(j<n2 && r2[j](1)<=b) ++j;
+        // Cut out all overlapping runs
+        for(int k=j; k<n2 && r2[k](0)<r(1); ++k){
+            if(r2[k](0)>b) res.emplace_back(b,r2[k](0));
+            b = std::max(b,r2[k](1));
+        }
+        if(b<r(1)) res.emplace_back(b,r(1));
+    }
+}
+
+enum class Index_op {union_op, difference_op};
+
+// Set operation on sorted indexes. Works on runs if both indexes are dense enough
+static void combine_index(const vector<int>& ind1, const vector<int>& ind2, vector<int>& res, Index_op op){
+    vector<Vector2i> r1, r2, r;
+    if(index_to_runs(ind1,r1) && index_to_runs(ind2,r2)){
+        switch(op){
+        case Index_op::union_op:        runs_union(r1,r2,r); break;
+        case Index_op::difference_op:   runs_difference(r1,r2,r); break;
+        }
+        runs_to_index(r,res);
+    } else {
+        res.clear();
+        switch(op){
+        case Index_op::union_op:
+            set_union(ind1.begin(),ind1.end(),ind2.begin(),ind2.end(),back_inserter(res));
+            break;
+        case Index_op::difference_op:
+            set_difference(ind1.begin(),ind1.end(),ind2.begin(),ind2.end(),back_inserter(res));
+            break;
+        }
+    }
+}
+
 
 void Selection::allocate_parser(){
     // Parse selection here
@@ -211,9 +308,9 @@ void Selection::append(const Selection &sel){
     if(!sel.system) throw Pteros_error("Can't append selection with undefined system!");
     if(sel.system!=system) throw Pteros_error("Can't append atoms from other system!");
 
-    copy(sel._index.begin(),sel._index.end(),back_inserter(_index));
-
-    sort_and_remove_duplicates();
+    vector<int> tmp;
+    combine_index(_index,sel._index,tmp,Index_op::union_op);
+    _index.swap(tmp);
 
     sel_text = "";
     parser.reset();
@@ -235,9 +332,8 @@ void Selection::append(int ind){
 void Selection::remove(const Selection &sel)
 {
     vector<int> tmp;
-    set_difference(_index.begin(),_index.end(),
-                   sel.index_begin(),sel.index_end(),back_inserter(tmp));
-    _index = tmp;
+    combine_index(_index,sel._index,tmp,Index_op::difference_op);
+    _index.swap(tmp);
     sel_text = "";
     parser.reset();
 }
@@ -538,9 +634,7 @@ Selection operator|(const Selection &sel1, const Selection &sel2){
     // Set frame
     res.frame = sel1.frame;
     // Combine indexes
-    std::set_union(sel1._index.begin(),sel1._index.end(),
-                   sel2._index.begin(),sel2._index.end(),
-                   back_inserter(res._index));
+    combine_index(sel1._index,sel2._index,res._index,Index_op::union_op);
     return res;
 }
 
@@ -577,9 +671,7 @@ Selection operator-(const Selection &sel1, const Selection &sel2)
     res.sel_text = "";
     res.parser.reset();
     res.frame = sel1.frame;
-    std::set_difference(sel1._index.begin(),sel1._index.end(),
-                        sel2._index.begin(),sel2._index.end(),
-                        back_inserter(res._index));
+    combine_index(sel1._index,sel2._index,res._index,Index_op::difference_op);
     return res;
 }
 
@@ -641,6 +733,10 @@ void Selection::apply(){
     }
 }
 
+std::string Selection::get_eval_timing() const {
+    return parser ? parser->timing_report() : "";
+}
+
 void Selection::set_frame(int fr){
     if(fr<0 || fr >= system->num_frames())
         throw Pteros_error("Invalid frame {} to set! Valid range is 0:", fr, system->num_frames());
@@ -753,6 +849,7 @@ std::string Selection::get_text() const {
 MatrixXf Selection::get_xyz(bool make_row_major_matrix) const {
     int n = _index.size();
     MatrixXf res;
+    if(!make_row_major_matrix && is_contiguous()) return xyz_view();
     if(make_row_major_matrix){
         res.resize(n,3);
         for(int i=0; i<n; ++i) res.row(i) = system->traj[frame].coord[_index[i]];
@@ -769,12 +866,38 @@ void Selection::set_xyz(pteros::MatrixXf_const_ref coord){
     // Sanity check
     if(coord.cols()!=n && coord.rows()!=n) throw Pteros_error("Invalid data size {} for selection of size {}", coord.size(),n);
     if(coord.cols()==n){ // Column major, default
+        if(is_contiguous()){
+            xyz_view() = coord;
+            return;
+        }
         for(int i=0; i<n; ++i) xyz(i) = coord.col(i);
     } else { // row-major, from python bindings
         for(int i=0; i<n; ++i) xyz(i) = coord.row(i);
     }
 }
 
+// Coordinates of atoms in frame are packed, so contiguous selection
+// is mapped as 3xN matrix directly
+static_assert(sizeof(Vector3f)==3*sizeof(float), "Vector3f should be packed!");
+
+Map<Matrix3Xf> Selection::xyz_view(int fr){
+    if(!is_contiguous()) throw Pteros_error("Coordinate view is only possible for contiguous selection!");
+    return Map<Matrix3Xf>(system->traj[fr].coord[_index[0]].data(),3,_index.size());
+}
+
+Map<const Matrix3Xf> Selection::xyz_view(int fr) const {
+    if(!is_contiguous()) throw Pteros_error("Coordinate view is only possible for contiguous selection!");
+    return Map<const Matrix3Xf>(system->traj[fr].coord[_index[0]].data(),3,_index.size());
+}
+
+Map<Matrix3Xf> Selection::xyz_view(){
+    return xyz_view(frame);
+}
+
+Map<const Matrix3Xf> Selection::xyz_view() const {
+    return xyz_view(frame);
+}
+
 MatrixXf Selection::get_vel(bool make_row_major_matrix) const {
     if(!system->traj[frame].has_vel()) throw Pteros_error("System has no velocities");
 
@@ -977,6 +1100,10 @@ Vector3f Selection::center(bool mass_weighted, Array3i_const_ref pbc, int pbc_at
 
 // Plain translation
 void Selection::translate(Vector3f_const_ref v){
+    if(is_contiguous()){
+        xyz_view().colwise() += v;
+        return;
+    }
     int i,n = _index.size();
     #pragma omp parallel for
     for(i=0; i<n; ++i) xyz(i) += v;
@@ -1006,6 +1133,8 @@ float Selection::rmsd(int fr1, int fr2) const{
        fr2<0 || fr2>=system->num_frames())
         throw Pteros_error("RMSD requested for frames {}:{} while the valid range is 0:{}", fr1,fr2,system->num_frames()-1);
 
+    if(is_contiguous()) return sqrt((xyz_view(fr1)-xyz_view(fr2)).squaredNorm()/n);
+
     #pragma omp parallel for reduction(+:res)
     for(int i=0; i<n; ++i)
         res += (xyz(i,fr1)-xyz(i,fr2)).squaredNorm();
@@ -1097,6 +1226,8 @@ float rmsd(const Selection& sel1, int fr1, const Selection& sel2, int fr2){
         throw Pteros_error("RMSD requested for frames {}:{} while the valid range is {}:{}",
                           fr1,fr2,sel1.system->num_frames()-1,sel2.system->num_frames()-1);
 
+    if(sel1.is_contiguous() && sel2.is_contiguous())
+        return sqrt((sel1.xyz_view(fr1)-sel2.xyz_view(fr2)).squaredNorm()/n1);
 
     #pragma omp parallel for reduction(+:res)
     for(int i=0; i<n1; ++i)
@@ -36,8 +36,10 @@
 #include <Eigen/Core>
 #include <boost/range/counting_range.hpp>
 #include <unordered_set>
+#include <unordered_map>
 #include <regex>
 #include <list>
+#include <chrono>
 
 using namespace std;
 using namespace pteros;
@@ -188,7 +190,10 @@ void Selection_parser::optimize(std::shared_ptr<MyAst>& node){
         // If not-coord dependent just optimize
         if(!node->is_coord_dependent){
             // Replace with float node
-            node = std::make_shared<MyAst>("",0,0,"FLOAT", fmt::format("{}", get_numeric(node)(0)));
+            int at = 0;
+            float val;
+            get_numeric(node)(&at,1,&val);
+            node = std::make_shared<MyAst>("",0,0,"FLOAT", fmt::format("{}", val));
             node->is_coord_dependent = false; // Keep correct flag just in case
         }
         break;
@@ -272,8 +277,107 @@ void Selection_parser::apply_ast(size_t fr, vector<int>& result){
     eval_node(tree,result);
 }
 
+static void print_timing(const std::shared_ptr<MyAst> &node, int level, string& out){
+    if(node->n_eval){
+        out += fmt::format("{:{}}{}: {} calls, {:.3f} ms per call\n",
+                           "", 2*level, node->name, node->n_eval, node->eval_time/node->n_eval);
+        ++level;
+    }
+    for(auto& ch: node->nodes) print_timing(ch,level,out);
+}
+
+string Selection_parser::timing_report() const {
+    string out;
+    if(tree) print_timing(tree,0,out);
+    return out;
+}
+
+// Numeric expressions are evaluated for blocks of atoms of this size
+static const int num_block_size = 256;
+
+enum class Comparison_op {eq, ne, lt, gt, le, ge};
+
+static Comparison_op get_comparison_op(const string& c){
+    if(c == "=" || c == "==") return Comparison_op::eq;
+    if(c == "!=" || c == "<>") return Comparison_op::ne;
+    if(c == "<") return Comparison_op::lt;
+    if(c == ">") return Comparison_op::gt;
+    if(c == "<=") return Comparison_op::le;
+    if(c == ">=") return Comparison_op::ge;
+    throw Pteros_error("Unknown comparison operator '{}'!",c);
+}
+
+// Compares two blocks of values and combines the result with the mask.
+// The switch is outside of the loops, so they are vectorized by the compiler.
+static void compare_block(Comparison_op op, const float* a, const float* b, int n, char* mask){
+    switch(op){
+    case Comparison_op::eq: for(int i=0;i<n;++i) mask[i] &= (a[i]==b[i]); break;
+    case Comparison_op::ne: for(int i=0;i<n;++i) mask[i] &= (a[i]!=b[i]); break;
+    case Comparison_op::lt: for(int i=0;i<n;++i) mask[i] &= (a[i]<b[i]); break;
+    case Comparison_op::gt: for(int i=0;i<n;++i) mask[i] &= (a[i]>b[i]); break;
+    case Comparison_op::le: for(int i=0;i<n;++i) mask[i] &= (a[i]<=b[i]); break;
+    case Comparison_op::ge: for(int i=0;i<n;++i) mask[i] &= (a[i]>=b[i]); break;
+    }
+}
+
+// Selects atoms, for which match(key) is true. Key of the atom is the id of
+// interned string or the chain character, so comparing keys is cheap.
+// Consecutive atoms usually share the key, so match() is only called
+// when the key changes.
+template<class K, class G, class M>
+static void match_keys(G get_key, M match,
+                       const vector<int>* subset, int Natoms,
+                       vector<int>& result)
+{
+    K last = K();
+    bool last_matched = false;
+    bool has_last = false;
+
+    // Atoms are visited in ascending order, so result is sorted and unique
+    auto body = [&](int at){
+        K key = get_key(at);
+        if(!has_last || key!=last){
+            last = key;
+            last_matched = match(key);
+            has_last = true;
+        }
+        if(last_matched) result.push_back(at);
+    };
+
+    if(!subset){
+        for(int at=0;at<Natoms;++at) body(at);
+    } else {
+        for(int at: *subset) body(at);
+    }
+}
+
+static bool match_any_regex(const string& str, const vector<std::regex>& regex_values){
+    for(auto& r: regex_values)
+        if(std::regex_match(str,r)) return true;
+    return false;
+}
+
+// Returns true if result of the node is always a subset of current subset
+static bool respects_subset(const std::shared_ptr<MyAst> &node){
+    using namespace peg::udl;
+    return node->tag == "WITHIN"_ || node->tag == "NUM_COMPARISON"_;
+}
 
 void Selection_parser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<int>& result){
+    // Only coordinate-dependent nodes are timed, others are evaluated once
+    if(!node->is_coord_dependent){
+        do_eval_node(node,result);
+        return;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    do_eval_node(node,result);
+    auto t1 = std::chrono::steady_clock::now();
+    node->eval_time += std::chrono::duration<double,std::milli>(t1-t0).count();
+    ++node->n_eval;
+}
+
+void Selection_parser::do_eval_node(const std::shared_ptr<MyAst> &node, std::vector<int>& result){
     using namespace peg::udl;
 
     result.clear();
@@ -291,63 +395,36 @@ void Selection_parser::eval_node(const std::shared_ptr<MyAst> &node, std::vector
     //---------------------------------------------------------------------------
     case "NUM_COMPARISON"_:
     {
-        vector<string> c; // comparison operators
-        vector<std::function<float(int)>> op; // comparison operands
-        vector<std::function<bool(float,float)>> comparison; // Function(s) to evaluate
-
-        if(node->nodes.size() == 3){ // simple
-            c.resize(1);
-            op.resize(2);
-            comparison.resize(1);
-
-            c[0]  = node->nodes[1]->token;
-            op[0] = get_numeric(node->nodes[0]);
-            op[1] = get_numeric(node->nodes[2]);
-
-        } else { // chained
-            c.resize(2);
-            op.resize(3);
-            comparison.resize(2);
-
-            c[0]  = node->nodes[1]->token;
-            c[1]  = node->nodes[3]->token;
-            op[0] = get_numeric(node->nodes[0]);
-            op[1] = get_numeric(node->nodes[2]);
-            op[2] = get_numeric(node->nodes[4]);
-        }
-
-        for(int i=0;i<c.size();++i){
-            if(c[i] == "=" || c[i]== "=="){
-                comparison[i] = [](float a, float b){ return a==b; };
-            } else if (c[i] == "!=" || c[i]=="<>"){
-                comparison[i] = [](float a, float b){ return a!=b; };
-            } else if (c[i] == "<"){
-                comparison[i] = [](float a, float b){ return a<b; };
-            } else if (c[i] == ">"){
-                comparison[i] = [](float a, float b){ return a>b; };
-            } else if (c[i] == "<="){
-                comparison[i] = [](float a, float b){ return a<=b; };
-            } else if (c[i] == ">="){
-                comparison[i] = [](float a, float b){ return a>=b; };
+        int Nop = (node->nodes.size()+1)/2; // 2 for simple and 3 for chained comparison
+        vector<numeric_func_t> op(Nop); // comparison operands
+        vector<Comparison_op> comparison(Nop-1); // comparison(s) to evaluate
+
+        for(int i=0;i<Nop;++i) op[i] = get_numeric(node->nodes[2*i]);
+        for(int i=0;i<Nop-1;++i) comparison[i] = get_comparison_op(node->nodes[2*i+1]->token);
+
+        // Atoms are processed by blocks. Operands are evaluated for the whole block
+        // and compared giving the mask of selected atoms.
+        int N = current_subset ? current_subset->size() : Natoms;
+        int ind[num_block_size];
+        float val[3][num_block_size];
+        char mask[num_block_size];
+
+        for(int b=0;b<N;b+=num_block_size){
+            int n = std::min(num_block_size,N-b);
+            const int* at;
+            if(current_subset){
+                at = current_subset->data()+b;
+            } else {
+                for(int i=0;i<n;++i) ind[i] = b+i;
+                at = ind;
             }
-        }
 
-        if(!current_subset) {
-            if(node->nodes.size() == 3){ // simple
-                for(int at=0;at<Natoms;++at)
-                    if( comparison[0](op[0](at),op[1](at)) ) result.push_back(at);
-            } else { // chained
-                for(int at=0;at<Natoms;++at)
-                    if( comparison[0](op[0](at),op[1](at)) && comparison[1](op[1](at),op[2](at)) ) result.push_back(at);
-            }
-        } else {
-            if(node->nodes.size() == 3){ // simple
-                for(int at: *current_subset)
-                    if( comparison[0](op[0](at),op[1](at)) ) result.push_back(at);
-            } else { // chained
-                for(int at: *current_subset)
-                    if( comparison[0](op[0](at),op[1](at)) && comparison[1](op[1](at),op[2](at)) ) result.push_back(at);
-            }
+            for(int i=0;i<Nop;++i) op[i](at,n,val[i]);
+
+            std::fill(mask,mask+n,1);
+            for(int i=0;i<Nop-1;++i) compare_block(comparison[i],val[i],val[i+1],n,mask);
+
+            for(int i=0;i<n;++i) if(mask[i]) result.push_back(at[i]);
         }
 
         break;
@@ -356,34 +433,8 @@ void Selection_parser::eval_node(const std::shared_ptr<MyAst> &node, std::vector
     //---------------------------------------------------------------------------
     case "STR_KEYWORD_EXPR"_:
     {
-        std::function<bool(int,const string&)> comp_func_str;
-        std::function<bool(int,const std::regex&)> comp_func_regex;
-
-        const string& keyword = node->nodes[0]->token;
-
-        if(keyword == "name"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].name == str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].name.c_str(),reg); };
-        } else if(keyword == "type"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].type_name == str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].type_name.c_str(),reg); };
-        } else if(keyword == "resname"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].resname == str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].resname.c_str(),reg); };
-        } else if(keyword == "tag"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].tag== str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].tag.c_str(),reg); };
-        } else if(keyword == "chain"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].chain == str[0]; };
-            comp_func_regex = [this](int at, const std::regex& reg){
-                string s(" ");
-                s[0] = sys->atoms[at].chain;
-                return std::regex_match(s.c_str(),reg);
-            };
-        }
-
-        list<string> str_values;
-        list<std::regex> regex_values;
+        vector<string> str_values;
+        vector<std::regex> regex_values;
         for(int i=1;i<node->nodes.size();++i){
             if(node->nodes[i]->name=="STR")
                 str_values.emplace_back(node->nodes[i]->token);
@@ -391,40 +442,57 @@ void Selection_parser::eval_node(const std::shared_ptr<MyAst> &node, std::vector
                 regex_values.emplace_back(node->nodes[i]->token);
         }
 
-        // Loop body
-        auto body = [&](int at){
-            // Cycle over regex values
-            bool reg_found = false;
-            for(const auto& reg: regex_values){
-                if(comp_func_regex(at,reg)){
-                    result.push_back(at);
-                    reg_found = true;
-                    break;
-                }
-            }
-
-            // If at least one regex matched no need to proceed with strings
-            if(reg_found) return;
-
-            // Cycle over string values
-            for(const auto& str: str_values){
-                if(comp_func_str(at,str)){
-                    result.push_back(at);
-                    break;
-                }
-            }
-        };
-
-        if(!current_subset){
-            for(int at=0;at<Natoms;++at) body(at);
-        } else {
-            for(int at: *current_subset) body(at);
+        const string& keyword = node->nodes[0]->token;
+        const auto& atoms = sys->atoms;
+
+        if(keyword == "chain"){
+            // Chains are single characters, only the first one is compared.
+            // Result of matching is cached for each character.
+            for(auto& str: str_values) str.resize(1);
+            signed char matched[256];
+            std::fill(matched,matched+256,-1);
+            match_keys<char>([&](int at){ return atoms[at].chain; },
+                             [&](char c){
+                                 signed char& m = matched[(unsigned char)c];
+                                 if(m<0){
+                                     string str(1,c);
+                                     m = std::find(str_values.begin(),str_values.end(),str)!=str_values.end()
+                                         || match_any_regex(str,regex_values);
+                                 }
+                                 return bool(m);
+                             },
+                             current_subset,Natoms,result);
+            break;
         }
 
-        // Sort unique
-        sort(result.begin(),result.end());
-        vector<int>::iterator it = unique(result.begin(), result.end());
-        result.resize( it - result.begin() );
+        Interned_string Atom::* field;
+        if(keyword == "name")
+            field = &Atom::name;
+        else if(keyword == "type")
+            field = &Atom::type_name;
+        else if(keyword == "resname")
+            field = &Atom::resname;
+        else if(keyword == "tag")
+            field = &Atom::tag;
+        else
+            break;
+
+        // Textual fields of atoms are interned, so literal strings are
+        // compared by ids. Regexes are evaluated once per distinct value.
+        vector<const string*> ids;
+        for(auto& str: str_values) ids.push_back(Interned_string(str).id());
+        unordered_map<const string*,bool> matched;
+
+        match_keys<const string*>([&](int at){ return (atoms[at].*field).id(); },
+                                  [&](const string* id){
+                                      if(std::find(ids.begin(),ids.end(),id)!=ids.end()) return true;
+                                      if(regex_values.empty()) return false;
+                                      auto it = matched.find(id);
+                                      if(it==matched.end())
+                                          it = matched.emplace(id,match_any_regex(*id,regex_values)).first;
+                                      return it->second;
+                                  },
+                                  current_subset,Natoms,result);
 
         break;
     }
@@ -530,18 +598,29 @@ void Selection_parser::eval_node(const std::shared_ptr<MyAst> &node, std::vector
             if(pure2 && !pure1) std::swap(node->nodes[0],node->nodes[2]);
 
             vector<int> res1,res2;
-            eval_node(node->nodes[0],res1);
-            current_subset = &res1; // Set subset for second
-            eval_node(node->nodes[2],res2); // Is using filled current subset
-
-            std::set_intersection(res1.begin(),res1.end(),res2.begin(),res2.end(),back_inserter(result));
+            auto old_subset = current_subset;
+            // Precomputed static part is used as candidate set directly without copying
+            // Nested nodes change current subset, so candidates are kept separately
+            vector<int>* cand;
+            if(node->nodes[0]->tag == "PRE"_){
+                cand = &node->nodes[0]->precomputed;
+            } else {
+                eval_node(node->nodes[0],res1);
+                cand = &res1;
+            }
+            current_subset = cand; // Set subset for second
 
-            // Reset subset
-            if(starting_subset){
-                current_subset = starting_subset;
+            if(respects_subset(node->nodes[2])){
+                // Result only contains candidates, no need to intersect
+                eval_node(node->nodes[2],result);
             } else {
-                current_subset = nullptr;
+                eval_node(node->nodes[2],res2); // Is using filled current subset
+                std::set_intersection(cand->begin(),cand->end(),
+                                      res2.begin(),res2.end(),back_inserter(result));
             }
+
+            // Restore subset of enclosing expression
+            current_subset = old_subset;
         }
 
         break;
@@ -687,6 +766,9 @@ void Selection_parser::eval_node(const std::shared_ptr<MyAst> &node, std::vector
             dum1._index = *current_subset;
         }
 
+        // Nothing to search
+        if(dum1.size()==0 || dum2.size()==0) break;
+
         // Set frame for both selections
         dum1.set_frame(frame);
         dum2.set_frame(frame);
@@ -747,74 +829,76 @@ Eigen::Vector3f Selection_parser::get_vector(const std::shared_ptr<MyAst> &node)
     } // case
 }
 
-// Returns callable, which returns value for numeric node for atom at
-std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<MyAst> &node){
+// Block function, which fills the block with constant value
+static numeric_func_t numeric_constant(float val){
+    return [val](const int* at, int n, float* out){ std::fill(out,out+n,val); };
+}
+
+// Block function, which evaluates given per-atom function for each atom in the block
+template<class F>
+static numeric_func_t numeric_per_atom(F func){
+    return [func](const int* at, int n, float* out){
+        for(int i=0;i<n;++i) out[i] = func(at[i]);
+    };
+}
+
+// Returns callable, which computes values of numeric node for the block of atoms.
+// Blocks are never larger than num_block_size.
+numeric_func_t Selection_parser::get_numeric(const std::shared_ptr<MyAst> &node){
     using namespace peg::udl;
 
     switch(node->tag){
     // terminals
     case "INTEGER"_:
-    {
-        float val = stol(node->token);
-        return [val](int at){ return val; };
-    }
+        return numeric_constant(stol(node->token));
 
     case "FLOAT"_:
-    {
-        float val = stof(node->token);
-        return [val](int at){ return val; };
-    }
+        return numeric_constant(stof(node->token));
 
     case "X"_:
-        if(node->nodes.empty())
-            return [this](int at){ return sys->traj[frame].coord[at](0); };
-        else {
-            float x = get_vector(node->nodes[0])[0];
-            return [x](int at){ return x; };
-        }
-
     case "Y"_:
-        if(node->nodes.empty())
-            return [this](int at){ return sys->traj[frame].coord[at](1); };
-        else {
-            float y = get_vector(node->nodes[0])[1];
-            return [y](int at){ return y; };
-        }
-
     case "Z"_:
+    {
+        int dim = (node->tag=="X"_) ? 0 : (node->tag=="Y"_) ? 1 : 2;
         if(node->nodes.empty())
-            return [this](int at){ return sys->traj[frame].coord[at](2); };
-        else {
-            float z = get_vector(node->nodes[0])[2];
-            return [z](int at){ return z; };
-        }
+            // Gather coordinates of atoms in the block
+            return [this,dim](const int* at, int n, float* out){
+                const auto& coord = sys->traj[frame].coord;
+                for(int i=0;i<n;++i) out[i] = coord[at[i]](dim);
+            };
+        else
+            return numeric_constant(get_vector(node->nodes[0])[dim]);
+    }
 
     case "BETA"_:
-        return [this](int at){ return sys->atoms[at].beta; };
+        return numeric_per_atom([this](int at){ return sys->atoms[at].beta; });
 
     case "OCC"_:
-        return [this](int at){ return sys->atoms[at].occupancy; };
+        return numeric_per_atom([this](int at){ return sys->atoms[at].occupancy; });
 
     case "INDEX"_:
-        return [](int at){ return at; };
+        return numeric_per_atom([](int at){ return at; });
 
     case "RESINDEX"_:
-        return [this](int at){ return sys->atoms[at].resindex; };
+        return numeric_per_atom([this](int at){ return sys->atoms[at].resindex; });
 
     case "RESID"_:
-        return [this](int at){ return sys->atoms[at].resid; };
+        return numeric_per_atom([this](int at){ return sys->atoms[at].resid; });
 
     case "MASS"_:
-        return [this](int at){ return sys->atoms[at].mass; };
+        return numeric_per_atom([this](int at){ return sys->atoms[at].mass; });
 
     case "CHARGE"_:
-        return [this](int at){ return sys->atoms[at].charge; };
+        return numeric_per_atom([this](int at){ return sys->atoms[at].charge; });
 
     // Compounds
     case "UNARY_MINUS"_:
     {
         auto func = get_numeric(node->nodes[0]);
-        return [func](int at){ return -func(at); };
+        return [func](const int* at, int n, float* out){
+            func(at,n,out);
+            for(int i=0;i<n;++i) out[i] = -out[i];
+        };
     }
 
     case "NUM_EXPR"_:
@@ -823,8 +907,8 @@ std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<My
     {
         int N = node->nodes.size();
 
-        vector<std::function<float(int)>> operands((N-1)/2+1);
-        vector<std::function<float(float,float)>> operators((N-1)/2);
+        vector<numeric_func_t> operands((N-1)/2+1);
+        vector<char> operators((N-1)/2);
 
         for(int i=0;i<operands.size();++i){
             operands[i] = get_numeric(node->nodes[i*2]);
@@ -832,26 +916,27 @@ std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<My
 
         for(int i=0;i<operators.size();++i){
             auto op = node->nodes[i*2+1]->token;
-            if     (op=="+") {
-                operators[i] = [](float a,float b){ return a+b; };
-            } else if(op=="-") {
-                operators[i] = [](float a,float b){ return a-b; };
-            } else if(op=="*") {
-                operators[i] = [](float a,float b){ return a*b; };
-            } else if(op=="/") {
-                operators[i] = [](float a,float b){
-                    if(b==0.0) throw Pteros_error("Division by zero in selection!");
-                    return a/b;
-                };
-            } else if(op=="^" || op=="**") {
-                operators[i] = [](float a,float b){ return std::pow(a,b); };
-            }
+            operators[i] = (op=="**") ? '^' : op[0];
         }
 
-        return [operands,operators](int at){
-            float result = operands[0](at);
-            for(int i=0;i<operators.size();++i) result = operators[i](result,operands[i+1](at));
-            return result;
+        // Operands are evaluated for the whole block and combined elementwise
+        return [operands,operators](const int* at, int n, float* out){
+            float val[num_block_size];
+            operands[0](at,n,out);
+            for(int k=0;k<int(operators.size());++k){
+                operands[k+1](at,n,val);
+                switch(operators[k]){
+                case '+': for(int i=0;i<n;++i) out[i] += val[i]; break;
+                case '-': for(int i=0;i<n;++i) out[i] -= val[i]; break;
+                case '*': for(int i=0;i<n;++i) out[i] *= val[i]; break;
+                case '/':
+                    for(int i=0;i<n;++i)
+                        if(val[i]==0.0) throw Pteros_error("Division by zero in selection!");
+                    for(int i=0;i<n;++i) out[i] /= val[i];
+                    break;
+                case '^': for(int i=0;i<n;++i) out[i] = std::pow(out[i],val[i]); break;
+                }
+            }
         };
     }
 
@@ -871,13 +956,13 @@ std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<My
 
         // Return distance
         if(pbc){
-            return [this,p](int at){
+            return numeric_per_atom([this,p](int at){
                 return sys->box(frame).distance(p, sys->traj[frame].coord[at]);
-            };
+            });
         } else {
-            return [this,p](int at){
+            return numeric_per_atom([this,p](int at){
                 return (p - sys->traj[frame].coord[at]).norm();
-            };
+            });
         }
     }
 
@@ -900,7 +985,7 @@ std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<My
 
         if(node->tag == "VECTOR"_){
             // For vector
-            return [this,p,dir,pbc](int at){
+            return numeric_per_atom([this,p,dir,pbc](int at){
                 Eigen::Vector3f atom = sys->traj[frame].coord[at];
                 // Get vector from p to current atom
                 Eigen::Vector3f v = atom - p;
@@ -914,10 +999,10 @@ std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<My
                 } else {
                     return (atom-v).norm();
                 }
-            };
+            });
         } else {
             // For plane
-            return [this,p,dir,pbc](int at){
+            return numeric_per_atom([this,p,dir,pbc](int at){
                 Eigen::Vector3f atom = sys->traj[frame].coord[at];
                 // Get vector from p to current atom
                 Eigen::Vector3f v = atom - p;
@@ -931,7 +1016,7 @@ std::function<float(int)> Selection_parser::get_numeric(const std::shared_ptr<My
                 } else {
                     return (atom-v).norm();
                 }
-            };
+            });
         }
     }
 
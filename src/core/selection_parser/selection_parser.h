@@ -42,10 +42,17 @@ namespace pteros {
 struct MyAst_annotation {
     bool is_coord_dependent;
     std::vector<int> precomputed;
+    // Accumulated evaluation time (in ms) and number of evaluations
+    // of coordinate-dependent node
+    double eval_time = 0.0;
+    int n_eval = 0;
 };
 
 typedef peg::AstBase<MyAst_annotation> MyAst;
 typedef std::function<void(std::vector<int>&)> result_func_t;
+/// Evaluates numeric node for the block of n atoms with given indexes.
+/// Values are written to out.
+typedef std::function<void(const int* at, int n, float* out)> numeric_func_t;
 
 /**
 *   Selection parser class.
@@ -73,6 +80,9 @@ public:
     /// Apply ast to the given frame. Fills the vector passed from
     /// enclosing System with selection indexes.
     void apply_ast(std::size_t fr, std::vector<int>& result);
+    /// Returns evaluation timing of coordinate-dependent nodes
+    /// accumulated over all calls of apply_ast()
+    std::string timing_report() const;
 
 private:
     /// AST structure 
@@ -84,7 +94,8 @@ private:
     int frame;    
 
     void eval_node(const std::shared_ptr<MyAst> &node, std::vector<int>& result);
-    std::function<float(int)> get_numeric(const std::shared_ptr<MyAst>& node);
+    void do_eval_node(const std::shared_ptr<MyAst> &node, std::vector<int>& result);
+    numeric_func_t get_numeric(const std::shared_ptr<MyAst>& node);
     Eigen::Vector3f get_vector(const std::shared_ptr<MyAst> &node);
 
     std::vector<int>* starting_subset;
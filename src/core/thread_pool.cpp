@@ -0,0 +1,226 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+#include "pteros/core/thread_pool.h"
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+using namespace pteros;
+
+namespace {
+// Set for the threads of the pool and for the threads marked as serial
+thread_local bool thread_is_serial = false;
+}
+
+// Single parallel loop shared by all participating threads
+struct Thread_pool::Job {
+    Job(int _n, int _chunk, const Body_t& _body, int max_slots):
+        n(_n), chunk(_chunk), body(_body), next(0), next_slot(0),
+        num_slots(max_slots), active(0), error(nullptr) {}
+
+    // Executes chunks until the range is exhausted
+    // Returns false if no free slot is left
+    bool run(){
+        int slot = next_slot.fetch_add(1);
+        if(slot>=num_slots) return false;
+
+        while(true){
+            int b = next.fetch_add(chunk);
+            if(b>=n) break;
+            int e = min(b+chunk,n);
+            try {
+                body(b,e,slot);
+            } catch(...) {
+                lock_guard<mutex> lock(m);
+                if(!error) error = current_exception();
+                // Skip remaining chunks
+                next.store(n);
+            }
+        }
+        return true;
+    }
+
+    int n, chunk;
+    const Body_t& body;
+    atomic<int> next;
+    atomic<int> next_slot;
+    int num_slots;
+    // Number of workers, which are still inside run()
+    int active;
+    exception_ptr error;
+    std::mutex m;
+    condition_variable cond;
+};
+
+
+Thread_pool &Thread_pool::instance()
+{
+    static Thread_pool pool;
+    return pool;
+}
+
+Thread_pool::Thread_pool(): num_threads(1), num_workers(0), stop_requested(false)
+{
+    set_num_threads(-1);
+}
+
+Thread_pool::~Thread_pool()
+{
+    stop_workers();
+}
+
+void Thread_pool::set_num_threads(int n)
+{
+    if(n<=0) n = std::thread::hardware_concurrency();
+    if(n<=0) n = 1;
+
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#endif
+
+    // Concurrent calls are serialized
+    lock_guard<std::mutex> lock(config_mutex);
+
+    if(n==num_threads && int(workers.size())==n-1) return;
+
+    // Loops running in other threads are finished by old workers,
+    // loops started meanwhile are executed serially
+    stop_workers();
+    start_workers(n);
+}
+
+void Thread_pool::parallel_for(int n, int chunk, const Body_t &body)
+{
+    if(n<=0) return;
+    if(chunk<=0) chunk = 1;
+
+    auto serial = [&]{
+        for(int b=0;b<n;b+=chunk) body(b,min(b+chunk,n),0);
+    };
+
+    // Serial execution if there is nothing to parallelize or if called
+    // from the thread, which is already running in parallel
+    if(thread_is_serial || n<=chunk){
+        serial();
+        return;
+    }
+
+    shared_ptr<Job> job;
+    int nw;
+    {
+        // Workers could be restarted by set_num_threads() in other thread
+        lock_guard<std::mutex> lock(jobs_mutex);
+        // Number of workers to wake up
+        nw = min<int>(num_workers, (n+chunk-1)/chunk-1);
+        if(nw>0){
+            job = make_shared<Job>(n,chunk,body,num_workers+1);
+            for(int i=0;i<nw;++i) jobs.push_back(job);
+            job->active = nw;
+        }
+    }
+
+    if(nw<=0){
+        serial();
+        return;
+    }
+    if(nw==1) jobs_cond.notify_one(); else jobs_cond.notify_all();
+
+    // Calling thread participates as well
+    thread_is_serial = true;
+    job->run();
+    thread_is_serial = false;
+
+    // Wait until all workers leave the job
+    {
+        unique_lock<std::mutex> lock(job->m);
+        job->cond.wait(lock, [&job]{ return job->active==0; });
+    }
+
+    if(job->error) rethrow_exception(job->error);
+}
+
+void Thread_pool::set_thread_serial(bool val)
+{
+    thread_is_serial = val;
+#ifdef _OPENMP
+    if(val) omp_set_num_threads(1);
+#endif
+}
+
+void Thread_pool::start_workers(int n)
+{
+    lock_guard<std::mutex> lock(jobs_mutex);
+    stop_requested = false;
+    for(int i=0;i<n-1;++i){
+        workers.emplace_back(&Thread_pool::worker_body,this);
+    }
+    num_workers = n-1;
+    num_threads = n;
+}
+
+void Thread_pool::stop_workers()
+{
+    {
+        lock_guard<std::mutex> lock(jobs_mutex);
+        stop_requested = true;
+        // No new jobs are queued after this point
+        num_workers = 0;
+    }
+    jobs_cond.notify_all();
+    // Workers finish all queued jobs before exiting
+    for(auto& w: workers) w.join();
+    workers.clear();
+}
+
+void Thread_pool::worker_body()
+{
+    thread_is_serial = true;
+    while(true){
+        shared_ptr<Job> job;
+        {
+            unique_lock<std::mutex> lock(jobs_mutex);
+            jobs_cond.wait(lock, [this]{ return stop_requested || !jobs.empty(); });
+            if(jobs.empty()) return; // Stop requested
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        job->run();
+
+        {
+            lock_guard<std::mutex> lock(job->m);
+            --job->active;
+        }
+        job->cond.notify_all();
+    }
+}
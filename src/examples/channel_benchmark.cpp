@@ -0,0 +1,75 @@
+#include "message_channel.h"
+#include "data_container.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+
+using namespace std;
+using namespace pteros;
+
+// Throughput of the channel, which delivers frames from trajectory reader to tasks.
+// One sender pushes already allocated containers, so only the cost
+// of passing messages through the channel is measured.
+
+using Data_channel = Message_channel<shared_ptr<Data_container>>;
+
+double run(int num_frames, int num_receivers, int buf_size, int batch){
+    vector<shared_ptr<Data_container>> frames(buf_size*2+num_receivers);
+    for(auto& f: frames) f = make_shared<Data_container>();
+
+    Data_channel channel;
+    channel.set_buffer_size(buf_size);
+
+    vector<thread> receivers;
+    vector<long> received(num_receivers,0);
+
+    auto start = chrono::steady_clock::now();
+
+    for(int i=0;i<num_receivers;++i){
+        receivers.emplace_back([&,i]{
+            if(batch>1){
+                vector<shared_ptr<Data_container>> data;
+                int n;
+                while((n = channel.recieve(data,batch))){
+                    received[i] += n;
+                    data.clear();
+                }
+            } else {
+                shared_ptr<Data_container> data;
+                while(channel.recieve(data)) ++received[i];
+            }
+        });
+    }
+
+    for(int i=0;i<num_frames;++i) channel.send(frames[i%frames.size()]);
+    channel.send_stop();
+
+    for(auto& t: receivers) t.join();
+
+    double sec = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+    long total = 0;
+    for(auto n: received) total += n;
+    if(total!=num_frames) cout << "Lost frames: " << num_frames-total << endl;
+
+    return num_frames/sec;
+}
+
+int main(int argc, char** argv){
+    int num_frames = argc>1 ? stoi(argv[1]) : 1000000;
+    int buf_size = argc>2 ? stoi(argv[2]) : 10;
+    int max_receivers = argc>3 ? stoi(argv[3]) : max(1u,thread::hardware_concurrency());
+
+    cout << "Frames: " << num_frames << ", buffer size: " << buf_size << endl;
+    cout << "receivers\tframes/s\tframes/s (batch 8)" << endl;
+
+    for(int n=1; ; n*=2){
+        if(n>max_receivers) n = max_receivers;
+        cout << n << "\t"
+             << run(num_frames,n,buf_size,1) << "\t"
+             << run(num_frames,n,buf_size,8) << endl;
+        if(n==max_receivers) break;
+    }
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <fstream>
 #include "pteros/core/grid.h"
+#include "boost/multi_array.hpp"
 #include "pteros/core/pteros_error.h"
 #include "pteros/analysis/trajectory_reader.h"
 #include "pteros/analysis/task_plugin.h"
@@ -64,7 +65,7 @@ protected:
                     // Get waters in this cell
                     n = searcher.cell(i,j,k).size();
                     for(w=0;w<n;++w){
-                        ind = searcher.cell(i,j,k)[w].index;
+                        ind = searcher.cell(i,j,k).index(w);
                         // For current water get delta of prev and cur coorfinates
                         // And add it to result grid
                         grid[i][j][k] += system.box(0).distance_squared(water.xyz(ind),last_pos.col(ind));
@@ -34,22 +34,26 @@
 namespace py = pybind11;
 using namespace pteros;
 
+// Textual fields are interned strings, which are exposed as python strings
+#define DEF_STRING_PROPERTY(_name) \
+    .def_property(#_name, [](const Atom& a) -> std::string {return a._name;}, [](Atom& a, const std::string& val){a._name=val;})
+
 void make_bindings_Atom(py::module& m){
 
     py::class_<Atom>(m, "Atom")
         .def(py::init<>())
         .def_readwrite("resid",     &Atom::resid)
-        .def_readwrite("name",      &Atom::name)
+        DEF_STRING_PROPERTY(name)
         .def_readwrite("chain",     &Atom::chain)
-        .def_readwrite("resname",   &Atom::resname)
-        .def_readwrite("tag",       &Atom::tag)
+        DEF_STRING_PROPERTY(resname)
+        DEF_STRING_PROPERTY(tag)
         .def_readwrite("occupancy", &Atom::occupancy)
         .def_readwrite("beta",      &Atom::beta)
         .def_readwrite("resindex",  &Atom::resindex)
         .def_readwrite("mass",      &Atom::mass)
         .def_readwrite("charge",    &Atom::charge)
         .def_readwrite("type",      &Atom::type)
-        .def_readwrite("type_name", &Atom::type_name)
+        DEF_STRING_PROPERTY(type_name)
         .def_readwrite("atomic_number", &Atom::atomic_number)
     ;
 }
@@ -134,7 +134,73 @@ void make_bindings_Distance_search(py::module& m){
                     obj->search_within(target,*res_ptr,include_self);
                     return vector_to_array<int>(res_ptr);
                 },"target"_a, "include_self"_a=true)
+
+            .def("count_within",[](Distance_search_within* obj, const Selection& target, bool include_self)
+                {
+                    std::vector<int>* res_ptr = new std::vector<int>;
+                    obj->count_within(target,*res_ptr,include_self);
+                    return vector_to_array<int>(res_ptr);
+                },"target"_a, "include_self"_a=true)
+
+            .def("search_knn",[](Distance_search_within* obj, const Selection& target, int k, bool include_self)
+                {
+                    std::vector<int>* res_ptr = new std::vector<int>;
+                    std::vector<float>* dist_ptr = new std::vector<float>;
+                    obj->search_knn(target,k,*res_ptr,dist_ptr,include_self);
+                    // Reshape to (target.size(),k)
+                    py::array r = vector_to_array<int>(res_ptr);
+                    r.resize(vector<size_t>{size_t(target.size()),size_t(k)});
+                    py::array d = vector_to_array<float>(dist_ptr);
+                    d.resize(vector<size_t>{size_t(target.size()),size_t(k)});
+                    return py::make_tuple(r,d);
+                },"target"_a, "k"_a, "include_self"_a=true)
     ;
-}
 
+    py::class_<Neighbor_list>(m, "Neighbor_list")
+            .def(py::init<float,const Selection&,float,bool,bool>(),
+                 "d"_a,"sel"_a,"skin"_a=0.1,"abs_ind"_a=false,"periodic"_a=false,
+                 py::keep_alive<1,3>())
+            .def(py::init<float,const Selection&,const Selection&,float,bool,bool>(),
+                 "d"_a,"sel1"_a,"sel2"_a,"skin"_a=0.1,"abs_ind"_a=false,"periodic"_a=false,
+                 py::keep_alive<1,3>(), py::keep_alive<1,4>())
+            .def("search_contacts",[](Neighbor_list* obj, bool do_dist_vec)
+                {
+                    std::vector<float>* dist_vec_ptr = do_dist_vec ? new std::vector<float> : nullptr;
+                    std::vector<Vector2i>* pairs_ptr = new std::vector<Vector2i>;
+                    obj->search_contacts(*pairs_ptr,dist_vec_ptr);
+                    // Interpret pairs array as 1D array of ints and reshape
+                    py::array m = vector_to_array<int>(reinterpret_cast<std::vector<int>*>(pairs_ptr),2*pairs_ptr->size());
+                    m.resize(vector<size_t>{pairs_ptr->size(),2});
+                    if(do_dist_vec){
+                        py::array v = vector_to_array<float>(dist_vec_ptr);
+                        return py::make_tuple(m,v);
+                    } else {
+                        return py::make_tuple(m,py::none());
+                    }
+                },"do_distances"_a=false)
+            .def("invalidate",&Neighbor_list::invalidate)
+            .def_property_readonly("num_builds",&Neighbor_list::num_builds)
+    ;
 
+    py::class_<Distance_search_batch>(m, "Distance_search_batch")
+            .def(py::init<bool,bool>(),"abs_ind"_a=false,"periodic"_a=false)
+            .def("add_query",py::overload_cast<float,const Selection&>(&Distance_search_batch::add_query),
+                 "d"_a,"sel"_a, py::keep_alive<1,3>())
+            .def("add_query",py::overload_cast<float,const Selection&,const Selection&>(&Distance_search_batch::add_query),
+                 "d"_a,"sel1"_a,"sel2"_a, py::keep_alive<1,3>(), py::keep_alive<1,4>())
+            .def("clear",&Distance_search_batch::clear)
+            .def_property_readonly("num_queries",&Distance_search_batch::num_queries)
+            .def("search",&Distance_search_batch::search)
+            .def("get_pairs",[](Distance_search_batch* obj, int q)
+                {
+                    auto pairs_ptr = new std::vector<Vector2i>(obj->get_pairs(q));
+                    py::array m = vector_to_array<int>(reinterpret_cast<std::vector<int>*>(pairs_ptr),2*pairs_ptr->size());
+                    m.resize(vector<size_t>{pairs_ptr->size(),2});
+                    return m;
+                },"q"_a)
+            .def("get_distances",[](Distance_search_batch* obj, int q)
+                {
+                    return vector_to_array<float>(new std::vector<float>(obj->get_distances(q)));
+                },"q"_a)
+    ;
+}
@@ -39,7 +39,7 @@ using namespace Eigen;
 using namespace pybind11::literals;
 
 #define DEF_PROPERTY(_name,_dtype) \
-    .def_property(#_name, [](Atom_proxy* obj){return obj->_name();}, [](Atom_proxy* obj,const _dtype& val){obj->_name()=val;})
+    .def_property(#_name, [](Atom_proxy* obj) -> _dtype {return obj->_name();}, [](Atom_proxy* obj,const _dtype& val){obj->_name()=val;})
 
 void make_bindings_Selection(py::module& m){
 
@@ -268,9 +268,11 @@ void make_bindings_Selection(py::module& m){
         // Util
         .def("is_large",&Selection::is_large)
         .def("size",&Selection::size)
+        .def("is_contiguous",&Selection::is_contiguous)
         .def("__len__", &Selection::size)
         .def("text_based",&Selection::text_based)
         .def("coord_dependent",&Selection::coord_dependent)
+        .def("get_eval_timing",&Selection::get_eval_timing)
         .def("flatten",&Selection::flatten)
         .def("to_gromacs_ndx",&Selection::to_gromacs_ndx)
         .def("find_index",&Selection::find_index)
@@ -97,6 +97,9 @@ void make_bindings_Trajectory_reader(py::module& m){
         .def("pre_process",&Task_plugin::pre_process)
         .def("process_frame",&Task_plugin::process_frame)
         .def("post_process",&Task_plugin::post_process)
+        .def("use_atoms",py::overload_cast<const string&>(&Task_plugin::use_atoms))
+        .def("use_atoms",py::overload_cast<const vector<int>&>(&Task_plugin::use_atoms))
+        .def("set_read_only_frames",&Task_plugin::set_read_only_frames)
 
         .def_readonly("system",&Task_plugin::system)
         .def_property_readonly("id",&Task_plugin::get_id)
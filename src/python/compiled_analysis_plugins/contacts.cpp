@@ -79,6 +79,9 @@ Options:
         If cutoff==0  uses the min of VdW and Coulommb cutoffs in the force field (if available).
     -padding, default: 0.1
         Padding added to cutoff in the case of VdW radii (cutoff=-1).
+    -skin, default: 0.1
+        Skin of the neighbour list. The list is only rebuilt when atoms
+        move further than skin/2 since previous rebuild.
     -transient <true|false>, default: false
         If true the contacts with last for single frame only are recorded.
 )";
@@ -133,6 +136,9 @@ protected:
             if(cutoff!=d) log->warn("Requested cutoff {} is different from cutoff in ff {}!",cutoff,d);
         }
 
+        // Neighbour list is rebuilt only if atoms moved too far
+        nlist.setup(cutoff,sel1,sel2,options("skin","0.1").as_float(),true,periodic);
+
         // Keep transient contacts lasting only 1 frame?
         keep_transient = options("transient","false").as_bool();
 
@@ -148,7 +154,7 @@ protected:
         sel1.apply();
         sel2.apply();
 
-        search_contacts(cutoff,sel1,sel2,bon,true,periodic,&dist_vec); // global indexes returned!
+        nlist.search_contacts(bon,&dist_vec); // global indexes returned!
 
         Vector2f total_en(0,0);
         pair_en.resize(bon.size());
@@ -252,6 +258,7 @@ protected:
 
     void post_process(const pteros::Frame_info &info) override {
         en_f.close();
+        log->info("Neighbour list was rebuilt {} times",nlist.num_builds());
 
         // Analyze atom contacts
         auto it = atom_contacts.begin();
@@ -353,6 +360,7 @@ private:
     Selection sel1, sel2, all;
     float cutoff;
     bool periodic;
+    Neighbor_list nlist;
     map<Vector2i,Contact,comparator> atom_contacts;
     map<Vector2i,Contact,comparator> res_contacts;
     bool keep_transient;
@@ -30,7 +30,6 @@
 
 #include "pteros/python/compiled_plugin.h"
 #include <fstream>
-#include <map>
 #include "pteros/core/distance_search.h"
 #include "pteros/core/system.h"
 
@@ -39,7 +38,7 @@ using namespace pteros;
 using namespace Eigen;
 
 
-TASK_PARALLEL(energy_par)
+TASK_ORDERED(energy_par,Vector2f)
 public:
 
     string help() override {
@@ -61,6 +60,21 @@ Options:
         Use periodicity?
 )";
     }
+
+    // Energies of shards are concatenated
+    void save_state(ostream& out) override {
+        write_state_header(out,"energy",1,data.size());
+        out.write((char*)data.data(),data.size()*sizeof(data[0]));
+    }
+
+    void merge_state(istream& in) override {
+        int64_t n = read_state_header(in,"energy",1);
+        decltype(data) e(n);
+        in.read((char*)e.data(),n*sizeof(e[0]));
+        if(!in) throw Pteros_error("Energies of shard are truncated!");
+        data.insert(data.end(),e.begin(),e.end());
+    }
+
 protected:
 
     void before_spawn() override {
@@ -86,9 +100,7 @@ protected:
         }
     }
 
-    void process_frame(const Frame_info &info) override {
-        Vector2f e;
-
+    void map_frame(const Frame_info &info, Vector2f& e) override {
         if(is_self_energy){
             sel1.apply();
             e = sel1.non_bond_energy(cutoff,is_periodic);
@@ -97,30 +109,24 @@ protected:
             sel2.apply();
             e = non_bond_energy(sel1,sel2,cutoff,0,is_periodic);
         }
-
-        data[info.absolute_time] = e;
     }
 
-    void post_process(const Frame_info& info) override {
+    // Energies come in the order of frames
+    void reduce_frame(Vector2f& e, const Frame_info &info) override {
+        data.emplace_back(info.absolute_time,e);
     }
 
-
-    void collect_data(const std::vector<std::shared_ptr<Task_base>>& tasks, int n_frames) override {
-        for(const auto& it: tasks){
-            auto h = dynamic_cast<energy_par*>(it.get());
-            data.insert(h->data.begin(),h->data.end());
-        }
-
+    void post_process(const Frame_info& info) override {
         // Output
         ofstream out(fmt::format("energy_{}.dat",get_id()));
 
         if(is_self_energy){
             out << "# Interaction self-energy of selection" << endl
-              << "# '" << sel1.get_text() << "'" << endl;
+              << "# '" << sel_texts[0] << "'" << endl;
         } else {
             out << "# Interaction energy of selections" << endl
-              << "# '" << sel1.get_text() << "'" << endl
-              << "# '" << sel2.get_text() << "'" << endl;
+              << "# '" << sel_texts[0] << "'" << endl
+              << "# '" << sel_texts[1] << "'" << endl;
         }
 
         out << "# time total q lj" << endl;
@@ -133,12 +139,14 @@ protected:
         out.close();
     }
 
+    bool is_mergeable() override { return true; }
+
 private:
     Selection sel1, sel2;
     bool is_self_energy;
     float cutoff;    
     bool is_periodic;
-    map<float,Vector2f> data;
+    vector<pair<float,Vector2f>> data;
     std::vector<string> sel_texts;
 };
 
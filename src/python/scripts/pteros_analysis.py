@@ -1,7 +1,7 @@
 #!/usr/bin/env python3
 
 from pteros import *
-import sys, os, signal, glob
+import sys, os, signal, glob, subprocess
 from inspect import getmembers, isclass
 import importlib.util
 import pteros_analysis_plugins
@@ -21,6 +21,11 @@ pteros_analysis.py -f <files> <processing options>... -task name1 <task1 options
 
 -log_level [off,trace,debug,info,warn,err,critical], default: "info"
     Set logging level
+
+-shards <n>
+    Process the trajectory in n separate processes and merge their results.
+    If -shard_id is not given all shards are run locally.
+    See '-help traj' for details.
 """)
 #--------------------------------------
 
@@ -135,6 +140,25 @@ if __name__ == '__main__':
             sys.exit(0)
 
 
+    # Local sharded mode: run each shard in separate process, then merge the results here
+    num_shards = opt('shards','1').as_int()
+    if num_shards>1 and not opt.has('shard_id') and not opt('merge_shards','false').as_bool():
+        # Shard options are put first, since trailing options belong to tasks
+        shard_args = []
+        if not opt.has('nt'):
+            shard_args += ['-nt', str(max(1,os.cpu_count()//num_shards))]
+
+        log.info('Running {} shards in separate processes...'.format(num_shards))
+        procs = [subprocess.Popen([sys.executable, sys.argv[0], '-shard_id', str(k)] + shard_args + sys.argv[1:])
+                 for k in range(num_shards)]
+        failed = [k for k,p in enumerate(procs) if p.wait()!=0]
+        if failed:
+            log.error('Shards {} failed!'.format(failed))
+            sys.exit(1)
+
+        opt,task_opts = parse_command_line([sys.argv[0], '-merge_shards', 'true'] + sys.argv[1:],"task")
+        reader.set_options(opt)
+
     # Load all supplied tasks
     files_to_load = set()
 
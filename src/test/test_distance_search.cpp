@@ -0,0 +1,212 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+// Distance search results are compared with brute force search
+
+#include "pteros/core/system.h"
+#include "pteros/core/distance_search.h"
+#include "pteros/core/pteros_error.h"
+#include "spdlog/fmt/fmt.h"
+#include <random>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+static int n_bad = 0;
+
+static void check(bool ok, const string& what){
+    if(!ok){
+        cout << "FAILED: " << what << endl;
+        ++n_bad;
+    }
+}
+
+// System with N random atoms in triclinic box
+static void make_system(System& sys, int N, unsigned seed){
+    Matrix3f m;
+    m.col(0) << 3.0, 0.0, 0.0;
+    m.col(1) << 1.2, 2.8, 0.0;
+    m.col(2) << 0.7, 0.9, 2.6;
+
+    mt19937 gen(seed);
+    uniform_real_distribution<float> frac(0.0,1.0);
+    vector<Atom> atoms(N);
+    vector<Vector3f> coord(N);
+    for(auto& c: coord) c = m*Vector3f(frac(gen),frac(gen),frac(gen));
+    sys.atoms_add(atoms,coord);
+    sys.box(0) = Periodic_box(m);
+}
+
+// Pairs with distances sorted for comparison. Pairs of single selection
+// are not oriented, so they are put in ascending order.
+struct Pair_dist {
+    int i, j;
+    float d;
+    bool operator<(const Pair_dist& o) const { return i<o.i || (i==o.i && j<o.j); }
+};
+
+static vector<Pair_dist> sorted_pairs(const vector<Vector2i>& pairs,
+                                      const vector<float>& dist, bool oriented){
+    vector<Pair_dist> res;
+    for(int k=0;k<int(pairs.size());++k){
+        int i = pairs[k](0), j = pairs[k](1);
+        if(!oriented && i>j) swap(i,j);
+        res.push_back({i,j,dist[k]});
+    }
+    sort(res.begin(),res.end());
+    return res;
+}
+
+static bool same_pairs(const vector<Pair_dist>& a, const vector<Pair_dist>& b){
+    if(a.size()!=b.size()) return false;
+    for(int k=0;k<int(a.size());++k)
+        if(a[k].i!=b[k].i || a[k].j!=b[k].j || std::abs(a[k].d-b[k].d)>1e-5) return false;
+    return true;
+}
+
+static void test_batch(bool abs_index, bool periodic){
+    System sys;
+    make_system(sys,400,2);
+    // Overlapping selections, so that some atoms are in both selections of query
+    Selection A(sys,0,199), B(sys,150,349), C(sys,300,399);
+
+    // Cutoffs are not sorted to check ordering of distance bins
+    struct Q { float d; const Selection* s1; const Selection* s2; };
+    vector<Q> q = {{0.5,&A,&B}, {0.2,&A,nullptr}, {0.35,&B,&C},
+                   {0.45,&C,&A}, {0.3,&B,nullptr}, {0.35,&A,&C}};
+
+    Distance_search_batch batch(abs_index,periodic);
+    for(auto& e: q){
+        if(e.s2) batch.add_query(e.d,*e.s1,*e.s2); else batch.add_query(e.d,*e.s1);
+    }
+    batch.search();
+
+    vector<Vector2i> ref;
+    vector<float> ref_dist;
+    for(int i=0;i<int(q.size());++i){
+        if(q[i].s2)
+            search_contacts(q[i].d,*q[i].s1,*q[i].s2,ref,abs_index,periodic,&ref_dist);
+        else
+            search_contacts(q[i].d,*q[i].s1,ref,abs_index,periodic,&ref_dist);
+
+        bool oriented = q[i].s2!=nullptr;
+        check(same_pairs(sorted_pairs(batch.get_pairs(i),batch.get_distances(i),oriented),
+                         sorted_pairs(ref,ref_dist,oriented)),
+              fmt::format("batch query {} (abs_index={}, periodic={})",i,abs_index,periodic));
+    }
+}
+
+// Brute force list of (distance,local index) of source atoms within d
+// from the atom of target in the order of increasing distance
+static vector<pair<float,int>> brute_within(float d, const Selection& src, const Selection& target,
+                                            int i, bool include_self, bool periodic){
+    vector<pair<float,int>> res;
+    const Periodic_box& box = src.box();
+    for(int j=0;j<src.size();++j){
+        if(!include_self && src.index(j)==target.index(i)) continue;
+        float r = periodic ? box.distance(target.xyz(i),src.xyz(j))
+                           : (target.xyz(i)-src.xyz(j)).norm();
+        if(r<=d) res.emplace_back(r,j);
+    }
+    sort(res.begin(),res.end());
+    return res;
+}
+
+static void test_knn_count(bool abs_index, bool periodic, bool include_self){
+    System sys;
+    make_system(sys,400,3);
+    // Target partially overlaps with source
+    Selection src(sys,0,299), target(sys,250,399);
+    string what = fmt::format("(abs_index={}, periodic={}, include_self={})",abs_index,periodic,include_self);
+
+    Distance_search_within searcher(0.4,src,abs_index,periodic);
+
+    vector<vector<pair<float,int>>> ref(target.size());
+    for(int i=0;i<target.size();++i) ref[i] = brute_within(0.4,src,target,i,include_self,periodic);
+
+    vector<int> counts;
+    searcher.count_within(target,counts,include_self);
+    bool ok = int(counts.size())==target.size();
+    for(int i=0;ok && i<target.size();++i) ok = counts[i]==int(ref[i].size());
+    check(ok,"count_within "+what);
+
+    // k larger than the number of source atoms gives all atoms within cutoff
+    for(int k: {1,4,src.size()+10}){
+        vector<int> res;
+        vector<float> dist;
+        searcher.search_knn(target,k,res,&dist,include_self);
+        ok = int(res.size())==target.size()*k && int(dist.size())==target.size()*k;
+        for(int i=0;ok && i<target.size();++i){
+            for(int j=0;ok && j<k;++j){
+                if(j<int(ref[i].size())){
+                    int ind = abs_index ? src.index(ref[i][j].second) : ref[i][j].second;
+                    ok = res[i*k+j]==ind && std::abs(dist[i*k+j]-ref[i][j].first)<1e-5;
+                } else {
+                    ok = res[i*k+j]==-1;
+                }
+            }
+        }
+        check(ok,fmt::format("search_knn with k={} ",k)+what);
+    }
+}
+
+static void test_large_cutoff(){
+    System sys;
+    make_system(sys,100,1);
+    Selection all(sys,"all");
+    vector<Vector2i> pairs;
+
+    // Cutoff larger than half of the box height is rejected in periodic case
+    bool thrown = false;
+    try {
+        search_contacts(1.4,all,pairs,false,true);
+    } catch(const Pteros_error&) {
+        thrown = true;
+    }
+    check(thrown,"periodic search with cutoff larger than half of the box height");
+
+    // ...but is fine without periodicity
+    search_contacts(1.4,all,pairs,false,false);
+}
+
+int main(int argc, char* argv[]){
+    test_large_cutoff();
+    for(bool abs_index: {false,true})
+        for(bool periodic: {false,true})
+            test_batch(abs_index,periodic);
+
+    for(bool abs_index: {false,true})
+        for(bool periodic: {false,true})
+            for(bool include_self: {false,true})
+                test_knn_count(abs_index,periodic,include_self);
+    return n_bad>0 ? 1 : 0;
+}
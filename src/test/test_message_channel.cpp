@@ -0,0 +1,165 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+// Stress test of the channel between trajectory reader and tasks:
+// every message, which was sent successfully, should be recieved
+// exactly once and in order of sending, even if stop comes during traffic
+
+#include "message_channel.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static int n_bad = 0;
+
+static void check(bool ok, const string& what){
+    if(!ok){
+        cout << "FAILED: " << what << endl;
+        ++n_bad;
+    }
+}
+
+// If stop_after>0 stop is sent when this number of messages is recieved
+static void run(int num_senders, int num_receivers, int buf_size, int num_msg, int stop_after){
+    string what = "(senders="+to_string(num_senders)+", receivers="+to_string(num_receivers)
+            +", buffer="+to_string(buf_size)+", stop after="+to_string(stop_after)+")";
+
+    Message_channel<int> channel(buf_size);
+    vector<int> num_sent(num_senders,0);
+    vector<vector<int>> received(num_receivers);
+    atomic<int> num_received{0};
+
+    vector<thread> threads;
+    for(int r=0;r<num_receivers;++r){
+        threads.emplace_back([&,r]{
+            // Half of receivers take messages in batches
+            if(r%2){
+                vector<int> batch;
+                int n;
+                while((n = channel.recieve(batch,1+r%4))){
+                    received[r].insert(received[r].end(),batch.begin(),batch.end());
+                    batch.clear();
+                    num_received += n;
+                }
+            } else {
+                int val;
+                while(channel.recieve(val)){
+                    received[r].push_back(val);
+                    ++num_received;
+                }
+            }
+        });
+    }
+
+    for(int s=0;s<num_senders;++s){
+        threads.emplace_back([&,s]{
+            for(int i=0;i<num_msg;++i){
+                if(!channel.send(s*num_msg+i)) break;
+                ++num_sent[s];
+            }
+        });
+    }
+
+    if(stop_after>0){
+        while(num_received<stop_after) this_thread::yield();
+        channel.send_stop();
+        for(auto& t: threads) t.join();
+    } else {
+        for(int i=num_receivers;i<int(threads.size());++i) threads[i].join();
+        channel.send_stop();
+        for(int i=0;i<num_receivers;++i) threads[i].join();
+    }
+
+    bool ordered = true;
+    vector<int> all;
+    for(auto& v: received){
+        vector<int> last(num_senders,-1);
+        for(int val: v){
+            if(val<=last[val/num_msg]) ordered = false;
+            last[val/num_msg] = val;
+        }
+        all.insert(all.end(),v.begin(),v.end());
+    }
+    check(ordered, "order of messages "+what);
+
+    vector<int> expected;
+    for(int s=0;s<num_senders;++s){
+        if(stop_after==0) check(num_sent[s]==num_msg, "sending without stop "+what);
+        for(int i=0;i<num_sent[s];++i) expected.push_back(s*num_msg+i);
+    }
+    sort(all.begin(),all.end());
+    check(all==expected, "recieved messages "+what);
+    check(channel.empty(), "empty channel after stop "+what);
+}
+
+// Stop should wake up senders waiting on full channel and receivers waiting on empty one
+static void test_wakeup(){
+    Message_channel<int> channel(4);
+    vector<int> sent(8,0);
+    vector<thread> senders;
+    for(int i=0;i<int(sent.size());++i) senders.emplace_back([&,i]{ sent[i] = channel.send(i); });
+    this_thread::sleep_for(chrono::milliseconds(100));
+    channel.send_stop();
+    for(auto& t: senders) t.join();
+    check(count(sent.begin(),sent.end(),1)==4, "only messages fitting the buffer are sent");
+
+    // Messages sent before stop are still recieved
+    int val, n = 0;
+    while(channel.recieve(val)) ++n;
+    check(n==4, "draining of stopped channel");
+
+    Message_channel<int> empty_channel(4);
+    vector<thread> receivers;
+    atomic<int> n_recieved{0};
+    for(int i=0;i<4;++i) receivers.emplace_back([&]{
+        int v;
+        while(empty_channel.recieve(v)) ++n_recieved;
+    });
+    this_thread::sleep_for(chrono::milliseconds(50));
+    empty_channel.send_stop();
+    for(auto& t: receivers) t.join();
+    check(n_recieved==0, "waking up receivers of empty channel");
+}
+
+int main(int argc, char* argv[]){
+    test_wakeup();
+    for(int rep=0;rep<3;++rep){
+        run(1,1,2,20000,0);
+        run(8,8,4,20000,0);
+        run(2,16,10,20000,0);
+        run(16,2,3,5000,0);
+        // Stop in the middle of traffic
+        run(8,8,4,20000,30000);
+        run(16,4,10,20000,1000);
+        run(4,16,2,20000,5000);
+    }
+    return n_bad>0 ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+// Neighbour list should give the same pairs as the grid search
+// in strongly skewed triclinic box
+
+#include "pteros/core/system.h"
+#include "pteros/core/distance_search.h"
+#include "pteros/core/neighbor_list.h"
+#include <random>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+static vector<Vector2i> sorted_pairs(const vector<Vector2i>& pairs){
+    vector<Vector2i> res;
+    for(const auto& p: pairs) res.emplace_back(std::min(p(0),p(1)),std::max(p(0),p(1)));
+    sort(res.begin(),res.end(),[](const Vector2i& a, const Vector2i& b){
+        return a(0)<b(0) || (a(0)==b(0) && a(1)<b(1));
+    });
+    return res;
+}
+
+int main(int argc, char* argv[]){
+    // b and c are tilted far beyond the half of a
+    Matrix3f m;
+    m.col(0) << 4.0, 0.0, 0.0;
+    m.col(1) << 3.8, 2.5, 0.0;
+    m.col(2) << 1.5, 1.2, 3.0;
+    Periodic_box box(m);
+
+    mt19937 gen(42);
+    uniform_real_distribution<float> frac(0.0,1.0), step(-0.04,0.04);
+
+    System sys;
+    vector<Atom> atoms(600);
+    vector<Vector3f> coord(600);
+    for(auto& c: coord) c = m*Vector3f(frac(gen),frac(gen),frac(gen));
+    sys.atoms_add(atoms,coord);
+    sys.box(0) = box;
+
+    Selection all(sys,"all");
+    Selection half1(sys,0,299);
+    Selection half2(sys,300,599);
+
+    Neighbor_list nl1(0.6,all,0.2,false,true);
+    Neighbor_list nl2(0.6,half1,half2,0.2,true,true);
+
+    int n_bad = 0;
+    vector<Vector2i> pairs, ref;
+    for(int st=0;st<10;++st){
+        nl1.search_contacts(pairs);
+        search_contacts(0.6,all,ref,false,true);
+        if(sorted_pairs(pairs)!=sorted_pairs(ref)){
+            cout << "Step " << st << ": one selection: "
+                 << pairs.size() << " pairs instead of " << ref.size() << endl;
+            ++n_bad;
+        }
+
+        nl2.search_contacts(pairs);
+        search_contacts(0.6,half1,half2,ref,true,true);
+        if(sorted_pairs(pairs)!=sorted_pairs(ref)){
+            cout << "Step " << st << ": two selections: "
+                 << pairs.size() << " pairs instead of " << ref.size() << endl;
+            ++n_bad;
+        }
+
+        // Small displacements, the list is not rebuilt on each step
+        for(int i=0;i<sys.num_atoms();++i)
+            sys.xyz(i) += Vector3f(step(gen),step(gen),step(gen));
+    }
+
+    if(nl1.num_builds()>=10){
+        cout << "Neighbour list is rebuilt on every step" << endl;
+        ++n_bad;
+    }
+
+    return n_bad>0 ? 1 : 0;
+}
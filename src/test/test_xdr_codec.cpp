@@ -0,0 +1,124 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2020, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *  
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+// Native XTC decoder should give the same coordinates as xdrfile library
+
+#include "xdr_codec.h"
+#include "xdrfile_xtc.h"
+#include "fmt/format.h"
+#include <random>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+using namespace pteros;
+
+static int n_bad = 0;
+
+static void check(bool ok, const string& what){
+    if(!ok){
+        cout << "FAILED: " << what << endl;
+        ++n_bad;
+    }
+}
+
+// Writes several frames with xdrfile, then decodes all of them with
+// Xtc_decoder for different number of requested atoms
+static void test_codec(int natoms, float prec){
+    string what = fmt::format("(natoms={}, precision={})",natoms,prec);
+    string fname = fmt::format("test_xdr_codec_{}.xtc",natoms);
+    const int nframes = 3;
+
+    // Clusters of close atoms (like in water) alternate with scattered atoms,
+    // so that both run-length and plain coding of XTC are used
+    mt19937 gen(natoms);
+    uniform_real_distribution<float> pos(0.0,5.0), delta(-0.1,0.1);
+    vector<vector<float>> ref(nframes, vector<float>(3*natoms));
+    matrix box = {{5,0,0},{0,5,0},{0,0,5}};
+
+    XDRFILE* xd = xdrfile_open(fname.c_str(),"w");
+    for(int fr=0;fr<nframes;++fr){
+        for(int i=0;i<natoms;++i){
+            for(int d=0;d<3;++d){
+                if(i%20<10 && i%3!=0) ref[fr][3*i+d] = ref[fr][3*(i-1)+d]+delta(gen);
+                else ref[fr][3*i+d] = pos(gen);
+            }
+        }
+        write_xtc(xd,natoms,fr*10,fr*0.5,box,(rvec*)ref[fr].data(),prec);
+    }
+    xdrfile_close(xd);
+
+    // Reference decoding by xdrfile
+    vector<vector<float>> xdr_coord(nframes, vector<float>(3*natoms));
+    xd = xdrfile_open(fname.c_str(),"r");
+    for(int fr=0;fr<nframes;++fr){
+        int step;
+        float t, p;
+        read_xtc(xd,natoms,&step,&t,box,(rvec*)xdr_coord[fr].data(),&p);
+    }
+    xdrfile_close(xd);
+
+    ifstream f(fname,ios::binary);
+    vector<char> data((istreambuf_iterator<char>(f)),istreambuf_iterator<char>());
+    f.close();
+    remove(fname.c_str());
+
+    for(int n: {natoms, 1, natoms/3, natoms-1}){
+        if(n<1) continue;
+        Xdr_reader xdr(data.data(),data.size());
+        Xtc_decoder decoder;
+        vector<float> out(3*n);
+        bool ok = true;
+        for(int fr=0;fr<nframes && ok;++fr){
+            Xtc_frame_header header;
+            read_xtc_header(xdr,header);
+            ok = header.natoms==natoms && header.step==fr*10 && header.time==fr*0.5f;
+            decoder.decode(xdr,natoms,n,out.data());
+            for(int i=0;i<n && ok;++i)
+                for(int d=0;d<3 && ok;++d){
+                    // Exactly as xdrfile and within precision from original data
+                    ok = out[3*i+d]==xdr_coord[fr][3*i+d]
+                         && std::abs(out[3*i+d]-ref[fr][3*i+d])<=0.5/prec+1e-5;
+                }
+        }
+        check(ok && xdr.bytes_left()==0, fmt::format("decoding of {} atoms ",n)+what);
+    }
+}
+
+int main(int argc, char* argv[]){
+    // Small frames are not compressed
+    test_codec(5,1000);
+    test_codec(1000,1000);
+    test_codec(1000,100);
+    test_codec(3001,10000);
+    return n_bad>0 ? 1 : 0;
+}
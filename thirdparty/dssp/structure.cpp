@@ -1261,12 +1261,12 @@ MProtein::MProtein(pteros::Selection& sel)
         //	13 - 16	Atom name Atom name.
 
         pad.copy(atom.mName, pad.size());
-        sel.name(i).copy(atom.mName, sel.name(i).size());
+        sel.name(i).str().copy(atom.mName, sel.name(i).size());
         //	17		Character altLoc Alternate location indicator.
         atom.mAltLoc = ' ';
         //	18 - 20	Residue name resName Residue name.
         pad.copy(atom.mResName, pad.size());
-        sel.resname(i).copy(atom.mResName, sel.resname(i).size());
+        sel.resname(i).str().copy(atom.mResName, sel.resname(i).size());
         //	22		Character chainID Chain identifier.
         atom.mChainID = sel.chain(i);
         //	23 - 26	Integer resSeq Residue sequence number.
@@ -1285,7 +1285,7 @@ MProtein::MProtein(pteros::Selection& sel)
         //	61 - 66	Real(6.2) tempFactor Temperature factor.
         atom.mTempFactor = sel.beta(i);
         //	77 - 78	LString(2) element Element symbol, right-justified.
-        sel.name(i).copy(atom.mElement, 2);
+        sel.name(i).str().copy(atom.mElement, 2);
         //	79 - 80	LString(2) charge Charge on the atom.
         atom.mCharge = 0;
 